@@ -4,7 +4,7 @@ uniform sampler2D map_diffuse;
 uniform sampler2D map_normal;
 uniform sampler2D map_ao;
 
-in vec2 tex_crd;
+#include internal/_material_inputs.inc
 
 vec3 surface_normal ()
 {
@@ -1,4 +1,5 @@
-#version 130
+#version 330 core
+#extension GL_ARB_explicit_attrib_location: require
 
 /*
  * Simplest vertex shader that provides the vertex
@@ -6,6 +7,8 @@
  * they were passed in from the model
  */
 
-vec4 vertex_pos () { return gl_Vertex; }
-vec3 vertex_norm () { return gl_Normal; }
-vec2 vertex_texcoord () { return gl_MultiTexCoord0.st; }
+#include internal/_attribs.inc
+
+vec4 vertex_pos () { return vec4(attr_position, 1.0); }
+vec3 vertex_norm () { return attr_normal; }
+vec2 vertex_texcoord () { return attr_texcoord; }
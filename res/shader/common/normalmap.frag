@@ -5,7 +5,7 @@
  */
 
 uniform sampler2D map_normal;
-in vec2 tex_crd;
+#include internal/_material_inputs.inc
 
 vec3 surface_normal ()
 {
@@ -0,0 +1,34 @@
+#version 330 core
+#extension GL_ARB_explicit_uniform_location: require
+#extension GL_ARB_explicit_attrib_location: require
+
+/*
+ * The final image out of the G-buffer's albedo and the light, the way
+ *   internal/material.frag does it in the final shading stage
+ */
+
+#include internal/_uniforms.inc
+#include internal/_gbuffer.inc
+
+layout (location = 1) uniform sampler2D lightmap_diffuse;
+layout (location = 2) uniform sampler2D lightmap_specular;
+
+layout (location = 204) uniform sampler2D gbuffer_albedo;
+
+layout (location = 0) out vec4 color;
+
+void main ()
+{
+	float depth = texture(gbuffer_screen_depth, texcrd).r;
+
+	// nothing was drawn here; leave the sky be
+	if (depth == 1.0)
+		discard;
+
+	vec3 light = texture(lightmap_diffuse, texcrd).rgb;
+	light += texture(lightmap_specular, texcrd).rgb;
+
+	color = texture(gbuffer_albedo, texcrd);
+	color.rgb *= light;
+	gl_FragDepth = depth;
+}
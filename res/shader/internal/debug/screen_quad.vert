@@ -4,12 +4,13 @@
 
 /* Debug - output a texture */
 
+layout (location = 0) in vec2 corner;
 layout (location = 0) uniform vec3 xy_size;
 noperspective out vec2 texcrd;
 
 void main ()
 {
-	texcrd = gl_Vertex.xy;
+	texcrd = corner;
 	gl_Position.xy = texcrd * xy_size.z + xy_size.xy;
 	gl_Position.zw = vec2(0.0, 1.0);
 }
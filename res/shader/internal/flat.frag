@@ -0,0 +1,9 @@
+#version 130
+#extension GL_ARB_explicit_uniform_location: require
+
+layout (location = 0) uniform vec4 color;
+
+void main ()
+{
+	gl_FragColor = color;
+}
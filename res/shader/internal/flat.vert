@@ -0,0 +1,11 @@
+#version 130
+#extension GL_ARB_explicit_attrib_location: require
+
+/* Flat colored 2D shapes, already in normalized device coordinates */
+
+layout (location = 0) in vec2 position;
+
+void main ()
+{
+	gl_Position = vec4(position, 0.0, 1.0);
+}
@@ -0,0 +1,63 @@
+#version 330 core
+#extension GL_ARB_explicit_uniform_location: require
+#extension GL_ARB_draw_buffers: require
+
+/*
+ * Writes what the atlas has for the pixel, as the material would have,
+ *   at the depth the model's surface is at there.
+ * STAGE is RENDER_STAGE_G_BUFFERS or RENDER_STAGE_SHADE_FINAL
+ */
+
+#define RENDER_STAGE_G_BUFFERS 0
+#define RENDER_STAGE_SHADE_FINAL 2
+
+#include internal/_uniforms.inc
+#include internal/_normal_pack.inc
+
+layout (location = 1) uniform sampler2D lightmap_diffuse;
+layout (location = 2) uniform sampler2D lightmap_specular;
+
+layout (location = 231) uniform float radius;
+layout (location = 232) uniform sampler2D atlas_normal;
+layout (location = 233) uniform sampler2D atlas_material;
+layout (location = 234) uniform sampler2D atlas_albedo;
+layout (location = 235) uniform sampler2D atlas_depth;
+
+in vec2 atlas_crd;
+in vec3 quad_pos;
+flat in vec3 view_dir;
+flat in mat3 rotation;
+
+void main ()
+{
+	float depth = texture(atlas_depth, atlas_crd).r;
+	if (depth >= 1.0)
+		discard;
+
+	// the views span the sphere in depth, from radius in front
+	vec3 world_pos = quad_pos + view_dir * radius * (1.0 - 2.0 * depth);
+	vec4 clip = proj * view * vec4(world_pos, 1.0);
+	gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+#if STAGE == RENDER_STAGE_G_BUFFERS
+
+	vec3 n = normal_unpack(texture(atlas_normal, atlas_crd).rg * 2.0 - 1.0);
+	gl_FragData[0].rg = normal_pack(rotation * n) * 0.5 + 0.5;
+	gl_FragData[1] = texture(atlas_material, atlas_crd);
+
+#ifdef GBUF_ALBEDO
+	gl_FragData[2] = texture(atlas_albedo, atlas_crd);
+#endif
+
+#elif STAGE == RENDER_STAGE_SHADE_FINAL
+
+	vec2 texcrd = clip.xy / clip.w * 0.5 + 0.5;
+
+	gl_FragData[0] = texture(atlas_albedo, atlas_crd);
+
+	vec3 light = texture(lightmap_diffuse, texcrd).rgb;
+	light += texture(lightmap_specular, texcrd).rgb;
+	gl_FragData[0].rgb *= light;
+
+#endif
+}
@@ -0,0 +1,53 @@
+#version 330 core
+#extension GL_ARB_explicit_uniform_location: require
+#extension GL_ARB_explicit_attrib_location: require
+
+/*
+ * A prop's impostor (render/impostor.h): a quad through the centre of
+ *   its bounding sphere, spanning it, facing the atlas view nearest to
+ *   the camera. These have to match render/impostor.cpp
+ */
+
+#include internal/_uniforms.inc
+#include internal/_attribs.inc
+
+layout (location = 8) in mat4 instance_model;
+
+layout (location = 230) uniform vec3 centre;
+layout (location = 231) uniform float radius;
+
+out vec2 atlas_crd;
+out vec3 quad_pos;
+flat out vec3 view_dir;
+flat out mat3 rotation;
+
+const float TWO_PI = 6.28318530718;
+
+void main ()
+{
+	rotation = mat3(instance_model);
+
+	// where the camera is, around the model's Z
+	vec3 world_centre = (instance_model * vec4(centre, 1.0)).xyz;
+	vec3 to_eye = transpose(rotation) * (camera_pos.xyz - world_centre);
+	float angle = atan(to_eye.y, to_eye.x);
+
+	int v = int(round(angle / TWO_PI * IMPOSTOR_VIEWS));
+	v = (v % IMPOSTOR_VIEWS + IMPOSTOR_VIEWS) % IMPOSTOR_VIEWS;
+
+	// the same as glm::lookAt made for that view when baking
+	float a = TWO_PI * float(v) / IMPOSTOR_VIEWS;
+	vec3 dir = vec3(cos(a), sin(a), 0.0);
+	vec3 right = vec3(-dir.y, dir.x, 0.0);
+	vec3 up = vec3(0.0, 0.0, 1.0);
+
+	vec2 corner = attr_position.xy;
+	vec3 p = centre + (right * corner.x + up * corner.y) * radius;
+
+	quad_pos = (instance_model * vec4(p, 1.0)).xyz;
+	view_dir = rotation * dir;
+	atlas_crd = vec2((float(v) + attr_texcoord.x) / IMPOSTOR_VIEWS,
+	                 attr_texcoord.y);
+
+	gl_Position = proj * view * vec4(quad_pos, 1.0);
+}
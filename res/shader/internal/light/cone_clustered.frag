@@ -0,0 +1,73 @@
+#version 330 core
+#extension GL_ARB_explicit_uniform_location: require
+#extension GL_ARB_explicit_attrib_location: require
+#extension GL_ARB_draw_buffers: require
+
+/*
+ * All of a batch of cone lights at once: the screen is split into
+ *   clusters (tiles, further split by view depth), and each pixel
+ *   goes through just the lights which reach its cluster
+ */
+
+#include internal/light/_sspace_pass.inc
+#include internal/_gbuffer.inc
+#include internal/light/_cone.inc
+
+/* Has to match t_cone_light_data in render/light/cone.cpp */
+struct t_cone_light
+{
+	mat4 view;
+	vec4 pos;
+	vec4 rgb_layer;
+};
+
+layout (std140) uniform cone_lights
+{
+	t_cone_light cone_light_data[CONE_ATLAS_SLOTS];
+};
+
+layout (location = 14) uniform ivec3 cluster_dims;
+/* Nearest depth of the slices, and the log of the far/near ratio */
+layout (location = 15) uniform vec2 cluster_depth;
+
+/* For each cluster, where its lights start in the list, and how many */
+layout (location = 16) uniform usamplerBuffer cluster_grid;
+layout (location = 17) uniform usamplerBuffer cluster_lights;
+
+int cluster_index (vec3 world_pos)
+{
+	ivec2 tile = ivec2(texcrd * vec2(cluster_dims.xy));
+	tile = clamp(tile, ivec2(0), cluster_dims.xy - 1);
+
+	float z = -(camera_view * vec4(world_pos, 1.0)).z;
+	z = max(z, cluster_depth.x);
+	int slice = int(log(z / cluster_depth.x) / cluster_depth.y
+			* float(cluster_dims.z));
+	slice = clamp(slice, 0, cluster_dims.z - 1);
+
+	return (slice * cluster_dims.y + tile.y) * cluster_dims.x + tile.x;
+}
+
+void main ()
+{
+	vec3 world_pos = gbuffer_world_pos();
+	vec3 world_norm = gbuffer_world_norm();
+	float spec_exp = gbuffer_specular_exp();
+
+	uvec2 range = texelFetch(cluster_grid, cluster_index(world_pos)).rg;
+
+	vec3 diffuse = vec3(0.0);
+	vec3 specular = vec3(0.0);
+	for (uint i = range.x; i < range.x + range.y; i++) {
+		int l = int(texelFetch(cluster_lights, int(i)).r);
+		cone_light(world_pos, world_norm, spec_exp,
+			cone_light_data[l].pos.xyz,
+			cone_light_data[l].rgb_layer.rgb,
+			cone_light_data[l].view,
+			int(cone_light_data[l].rgb_layer.a),
+			diffuse, specular);
+	}
+
+	OUT_DIFFUSE = diffuse;
+	OUT_SPECULAR = specular;
+}
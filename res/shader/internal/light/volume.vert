@@ -0,0 +1,20 @@
+#version 330 core
+#extension GL_ARB_explicit_uniform_location: require
+#extension GL_ARB_explicit_attrib_location: require
+
+/*
+ * The volume a light reaches, for marking it in the stencil buffer:
+ *   the cube of the light's clip space, taken back into the world
+ *   and then into the camera's clip space
+ */
+
+#include internal/_uniforms.inc
+#include internal/_attribs.inc
+
+layout (location = 0) uniform mat4 light_inverse;
+
+void main ()
+{
+	gl_Position = camera_proj * camera_view
+		* (light_inverse * vec4(attr_position, 1.0));
+}
@@ -14,7 +14,10 @@
 vec3 surface_normal ();
 float specular_exponent () { return 90.0; }
 
-/* Called during final shading stage */
+/*
+ * Called during final shading stage, or with GBUF_ALBEDO during
+ *   g-buffer stage, the final image being composited from that
+ */
 vec4 surface_color ();
 
 /* ================================================== */
@@ -23,54 +26,64 @@ vec4 surface_color ();
 #define RENDER_STAGE_LIGHTING_LSPACE 1
 #define RENDER_STAGE_SHADE_FINAL 2
 #define RENDER_STAGE_WIREFRAME 3
+#define RENDER_STAGE_DEPTH_PREPASS 4
+#define RENDER_STAGE_VISIBILITY 5
+#define RENDER_STAGE_VISBUF_RESOLVE 6
+
+/* STAGE is #defined by the engine: one program per render stage */
 
-layout (location = 0) uniform int stage;
+#include internal/_normal_pack.inc
+
+/* Must match the unpacking in internal/_gbuffer.inc */
+const float GBUF_MAX_SPECULAR_EXP = 255.0;
 
 layout (location = 1) uniform sampler2D lightmap_diffuse;
 layout (location = 2) uniform sampler2D lightmap_specular;
 
-in vec3 world_pos;
-in vec3 world_normal;
-in vec4 screen_crd;
-in mat3 TBN;
+#include internal/_material_inputs.inc
 
 #define gl_FragColor gl_FragData[0]
 
+#if STAGE == RENDER_STAGE_VISBUF_RESOLVE
+/* Works out the inputs; see internal/visbuf/resolve.frag */
+void visbuf_interpolate ();
+#endif
+
 void main ()
 {
-	switch (stage) {
-	case RENDER_STAGE_G_BUFFERS:
+#if STAGE == RENDER_STAGE_G_BUFFERS || STAGE == RENDER_STAGE_VISBUF_RESOLVE
+
+#if STAGE == RENDER_STAGE_VISBUF_RESOLVE
+	visbuf_interpolate();
+#endif
 
-		#define GBUF_WORLD_POS gl_FragData[0].rgb
-		#define GBUF_WORLD_NORM gl_FragData[1].rgb
-		#define GBUF_SPECULAR_DATA gl_FragData[2].r
+	// the position comes from the depth
+	#define GBUF_NORMAL gl_FragData[0].rg
+	#define GBUF_MATERIAL gl_FragData[1]
 
-		GBUF_WORLD_POS = world_pos;
-		GBUF_WORLD_NORM = TBN * normalize(surface_normal());
-		GBUF_SPECULAR_DATA = specular_exponent();
+	GBUF_NORMAL = normal_pack(TBN * surface_normal()) * 0.5 + 0.5;
+	GBUF_MATERIAL = vec4(
+		specular_exponent() / GBUF_MAX_SPECULAR_EXP, 0.0, 0.0, 0.0);
 
-		break;
+#ifdef GBUF_ALBEDO
+	gl_FragData[2] = surface_color();
+#endif
 
-	case RENDER_STAGE_LIGHTING_LSPACE:
-		gl_FragColor.r = screen_crd.z;
-		break;
+#elif STAGE == RENDER_STAGE_SHADE_FINAL
 
-	case RENDER_STAGE_SHADE_FINAL:
+	vec2 texcrd = screen_crd.xy / screen_crd.w * 0.5 + 0.5;
 
-		vec2 texcrd = screen_crd.xy / screen_crd.w * 0.5 + 0.5;
+	// call the actual user shader
+	gl_FragColor = surface_color();
 
-		// call the actual user shader
-		gl_FragColor = surface_color();
+	vec3 light = texture(lightmap_diffuse, texcrd).rgb;
+	light += texture(lightmap_specular, texcrd).rgb;
 
-		vec3 light = texture(lightmap_diffuse, texcrd).rgb;
-		light += texture(lightmap_specular, texcrd).rgb;
+	gl_FragColor.rgb *= light;
 
-		gl_FragColor.rgb *= light;
-		break;
+#elif STAGE == RENDER_STAGE_WIREFRAME
 
-	case RENDER_STAGE_WIREFRAME:
+	gl_FragColor = vec4(1.0, 0.0, 0.0, 0.5);
 
-		gl_FragColor = vec4(1.0, 0.0, 0.0, 0.5);
-		break;
-	}
+#endif
 }
@@ -15,13 +15,24 @@ vec2 vertex_texcoord ();
 #define RENDER_STAGE_LIGHTING_LSPACE 1
 #define RENDER_STAGE_SHADE_FINAL 2
 #define RENDER_STAGE_WIREFRAME 3
-layout (location = 0) uniform int stage;
+#define RENDER_STAGE_DEPTH_PREPASS 4
+#define RENDER_STAGE_VISIBILITY 5
+#define RENDER_STAGE_VISBUF_RESOLVE 6
 
-layout (location = 100) uniform mat4 proj;
-layout (location = 116) uniform mat4 view;
-layout (location = 132) uniform mat4 model;
+/* STAGE is #defined by the engine: one program per render stage */
 
-attribute vec3 tangent;
+#include internal/_uniforms.inc
+
+layout (location = 1) in vec3 tangent;
+
+/* For layered rendering: which layers to emit the triangle into */
+layout (location = 7) in uint layer_mask;
+flat out uint vert_layer_mask;
+
+#ifdef INSTANCED
+/* Instanced drawing: the transform comes per instance instead */
+layout (location = 8) in mat4 instance_model;
+#endif
 
 out vec2 tex_crd;
 out vec4 screen_crd;
@@ -29,21 +40,31 @@ out vec3 world_normal;
 out vec3 world_pos;
 out mat3 TBN;
 
+/* The depth pre-pass and the G-buffer pass must agree to the bit */
+invariant gl_Position;
+
 void main ()
 {
+#ifdef INSTANCED
+	mat4 to_world = instance_model;
+#else
+	mat4 to_world = model;
+#endif
+
 	vec4 pos = vertex_pos();
 	vec4 normal = vec4(vertex_norm(), 0.0);
 	tex_crd = vertex_texcoord();
 
-	gl_Position = proj * view * model * pos;
+	gl_Position = proj * view * to_world * pos;
 	screen_crd = gl_Position;
 
-	world_normal = (model * normal).xyz;
-	world_pos = (model * pos).xyz;
+	world_normal = (to_world * normal).xyz;
+	world_pos = (to_world * pos).xyz;
+	vert_layer_mask = layer_mask;
 
-	if (stage == RENDER_STAGE_G_BUFFERS) {
-		vec3 w_tangent = (model * vec4(tangent, 0.0)).xyz;
-		vec3 w_bitangent = cross(world_normal, w_tangent);
-		TBN = mat3(w_tangent, w_bitangent, world_normal);
-	}
+#if STAGE == RENDER_STAGE_G_BUFFERS
+	vec3 w_tangent = (to_world * vec4(tangent, 0.0)).xyz;
+	vec3 w_bitangent = cross(world_normal, w_tangent);
+	TBN = mat3(w_tangent, w_bitangent, world_normal);
+#endif
 }
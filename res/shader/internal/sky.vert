@@ -4,6 +4,8 @@
 
 out float height_factor;
 
+layout (location = 0) in vec3 position;
+
 layout (location = 100) uniform mat4 proj;
 layout (location = 116) uniform mat4 view;
 
@@ -11,8 +13,8 @@ void main ()
 {
 	mat4 view_notranslate = view;
 	view_notranslate[3].xyz *= 0.0;
-	gl_Position = proj * view_notranslate * gl_Vertex;
+	gl_Position = proj * view_notranslate * vec4(position, 1.0);
 	gl_Position.z = 0.5;
-	height_factor = gl_Vertex.z * 0.5;
+	height_factor = position.z * 0.5;
 }
 
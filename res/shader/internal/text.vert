@@ -1,9 +1,13 @@
 #version 130
+#extension GL_ARB_explicit_attrib_location: require
+
+layout (location = 0) in vec2 position;
+layout (location = 3) in vec2 texcoord;
 
 varying vec2 tex_crd;
 
 void main ()
 {
-	gl_Position = gl_ProjectionMatrix * gl_ModelViewMatrix * gl_Vertex;
-	tex_crd = gl_MultiTexCoord0.st;
+	gl_Position = vec4(position, 0.0, 1.0);
+	tex_crd = texcoord;
 }
@@ -2,7 +2,7 @@
 #extension GL_ARB_explicit_uniform_location: require
 #extension GL_ARB_explicit_attrib_location: require
 
-varying vec2 tex_crd;
+layout (location = 0) in vec3 position;
 
 layout (location = 100) uniform mat4 proj;
 layout (location = 116) uniform mat4 view;
@@ -14,6 +14,6 @@ void main ()
 	vec3 center = (cuboid[0] + cuboid[1]) * 0.5;
 	vec3 scale = (cuboid[1] - cuboid[0]) * 0.5;
 
-	vec3 vert = gl_Vertex.xyz * scale + center;
+	vec3 vert = position * scale + center;
 	gl_Position = proj * view * vec4(vert, 1.0);
 }
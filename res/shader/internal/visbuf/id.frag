@@ -0,0 +1,18 @@
+#version 330 core
+#extension GL_ARB_explicit_uniform_location: require
+
+/*
+ * RENDER_STAGE_VISIBILITY: which draw, and which of its triangles
+ */
+
+#include internal/visbuf/_visbuf.inc
+
+/* Set for each draw by visbuf_draw */
+layout (location = 220) uniform uint draw_id;
+
+layout (location = 0) out uint visbuf_id;
+
+void main ()
+{
+	visbuf_id = (draw_id << VISBUF_TRIANGLE_BITS) | uint(gl_PrimitiveID);
+}
@@ -0,0 +1,95 @@
+#version 330 core
+#extension GL_ARB_explicit_uniform_location: require
+
+/*
+ * RENDER_STAGE_VISBUF_RESOLVE: get back what internal/material.vert
+ *   would have passed on for the pixel, out of its triangle.
+ * Those inputs are globals of this shader here, which the user shaders
+ *   and internal/material.frag read through internal/_material_inputs.inc
+ */
+
+#include internal/_uniforms.inc
+#include internal/visbuf/_visbuf.inc
+
+layout (location = 214) uniform usampler2D ids;
+layout (location = 215) uniform samplerBuffer draws;
+layout (location = 216) uniform usamplerBuffer draw_groups;
+layout (location = 217) uniform samplerBuffer vertices;
+layout (location = 218) uniform usamplerBuffer indices;
+layout (location = 219) uniform uint group;
+
+#define MATERIAL_INPUTS_OWNER
+#include internal/_material_inputs.inc
+
+/* t_mesh_vertex, as floats: position, normal, texcoord, tangent */
+const int VERTEX_FLOATS = 11;
+
+vec3 fetch_vec3 (int i)
+{
+	return vec3(texelFetch(vertices, i).r,
+	            texelFetch(vertices, i + 1).r,
+	            texelFetch(vertices, i + 2).r);
+}
+
+float cross2 (vec2 a, vec2 b)
+{
+	return a.x * b.y - a.y * b.x;
+}
+
+void visbuf_interpolate ()
+{
+	uint id = texelFetch(ids, ivec2(gl_FragCoord.xy), 0).r;
+	if (id == VISBUF_EMPTY)
+		discard;
+
+	int draw = int(id >> VISBUF_TRIANGLE_BITS);
+	if (texelFetch(draw_groups, draw).r != group)
+		discard;
+
+	int d = draw * VISBUF_DRAW_TEXELS;
+	mat4 to_world = mat4(texelFetch(draws, d),
+	                     texelFetch(draws, d + 1),
+	                     texelFetch(draws, d + 2),
+	                     texelFetch(draws, d + 3));
+	uint first = floatBitsToUint(texelFetch(draws, d + 4).x);
+	int tri = int(first + 3u * (id & VISBUF_TRIANGLE_MASK));
+
+	vec3 pos[3];
+	vec3 norm[3];
+	vec2 tex[3];
+	vec3 tangent[3];
+	vec2 ndc[3];
+	vec3 inv_w;
+
+	for (int i = 0; i < 3; i++) {
+		int v = int(texelFetch(indices, tri + i).r) * VERTEX_FLOATS;
+		pos[i] = (to_world * vec4(fetch_vec3(v), 1.0)).xyz;
+		norm[i] = fetch_vec3(v + 3);
+		tex[i] = vec2(texelFetch(vertices, v + 6).r,
+		              texelFetch(vertices, v + 7).r);
+		tangent[i] = fetch_vec3(v + 8);
+
+		vec4 clip = camera_proj * camera_view * vec4(pos[i], 1.0);
+		ndc[i] = clip.xy / clip.w;
+		inv_w[i] = 1.0 / clip.w;
+	}
+
+	// barycentrics on the screen, then corrected for perspective
+	vec2 p = gl_FragCoord.xy / vec2(textureSize(ids, 0)) * 2.0 - 1.0;
+	vec3 b = vec3(cross2(ndc[1] - p, ndc[2] - p),
+	              cross2(ndc[2] - p, ndc[0] - p),
+	              cross2(ndc[0] - p, ndc[1] - p));
+	b *= inv_w;
+	b /= b.x + b.y + b.z;
+
+	#define INTERPOLATE(a) (b.x * a[0] + b.y * a[1] + b.z * a[2])
+
+	world_pos = INTERPOLATE(pos);
+	tex_crd = INTERPOLATE(tex);
+	world_normal = (to_world * vec4(INTERPOLATE(norm), 0.0)).xyz;
+	screen_crd = camera_proj * camera_view * vec4(world_pos, 1.0);
+
+	vec3 w_tangent = (to_world * vec4(INTERPOLATE(tangent), 0.0)).xyz;
+	vec3 w_bitangent = cross(world_normal, w_tangent);
+	TBN = mat3(w_tangent, w_bitangent, world_normal);
+}
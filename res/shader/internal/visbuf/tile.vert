@@ -0,0 +1,29 @@
+#version 330 core
+#extension GL_ARB_explicit_uniform_location: require
+
+/*
+ * RENDER_STAGE_VISBUF_RESOLVE: a quad for each instance, over the tile
+ *   the instance stands for in the list of the group being resolved
+ *   (see internal/visbuf/classify.comp)
+ */
+
+#include internal/visbuf/_visbuf.inc
+
+layout (location = 210) uniform usamplerBuffer tiles;
+layout (location = 211) uniform uint tile_offset;
+layout (location = 212) uniform uint tiles_x;
+layout (location = 213) uniform vec2 screen_size;
+
+const vec2 corners[6] = vec2[6](
+	vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+	vec2(0.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+
+void main ()
+{
+	uint t = texelFetch(tiles, int(tile_offset) + gl_InstanceID).r;
+	vec2 tile = vec2(t % tiles_x, t / tiles_x);
+
+	// the last row and column may stick out, and get clipped
+	vec2 px = (tile + corners[gl_VertexID]) * float(VISBUF_TILE_SIZE);
+	gl_Position = vec4(px / screen_size * 2.0 - 1.0, 0.0, 1.0);
+}
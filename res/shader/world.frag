@@ -1,6 +1,6 @@
 #version 130
 
-in vec3 world_normal;
+#include internal/_material_inputs.inc
 
 vec4 surface_color ()
 {
@@ -138,6 +138,8 @@ void load_map (std::string path)
 		fatal("Cannot load map %s: no ents file", path.c_str());
 	while (!f.eof())
 		read_single_entity(f);
+
+	vis_finish_world();
 }
 
 COMMAND_ROUTINE (loadmap)
@@ -193,6 +195,18 @@ bool t_bound_box::intersects (const t_bound_box& b) const
 	    && tmp.end.z >= tmp.start.z;
 }
 
+t_bound_box t_bound_box::transformed (const mat4& m) const
+{
+	t_bound_box r = { vec3(INFINITY), vec3(-INFINITY) };
+	for (int i = 0; i < 8; i++) {
+		vec3 corner = { (i & 1 ? end : start).x,
+		                (i & 2 ? end : start).y,
+		                (i & 4 ? end : start).z };
+		r.expand(vec3(m * vec4(corner, 1.0)));
+	}
+	return r;
+}
+
 void t_bound_box::intersect (const t_bound_box& b)
 {
 	start = max_components(start, b.start);
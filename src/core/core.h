@@ -48,6 +48,9 @@ struct t_bound_box
 
 	bool intersects (const t_bound_box& b) const;
 
+	/* The box containing this one after being transformed by m */
+	t_bound_box transformed (const mat4& m) const;
+
 	/*
 	 * In a case with no intersection, the _guarded version
 	 * brings the box to a state where its volume is 0.
@@ -1,5 +1,6 @@
 #include "entity.h"
 #include "render/vis.h"
+#include "render/light/cone.h"
 #include "ent/_headers.inc"
 
 t_ent_registry ent_reg;
@@ -27,6 +28,15 @@ void e_base::on_event (const std::string& event) const
 
 void e_base::moved ()
 {
+	t_bound_box b = get_bbox();
+	light_cone_entity_moved(this, moved_bbox, b);
+
+	moved_bbox = b;
+	if (placed) {
+		has_moved = true;
+		moved_tick = tick;
+	}
+	placed = true;
 	vis_requery_entity(this);
 }
 
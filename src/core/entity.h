@@ -75,6 +75,30 @@ class e_base
 
 	virtual void render () const = 0;
 
+	/*
+	 * Queue the entity up to be drawn instanced along with others
+	 *   (render/instancing.h) in place of render(). Those which
+	 *   cannot be drawn that way return false
+	 */
+	virtual bool render_instanced (uint32_t layer_mask) const
+	{ return false; }
+
+	/*
+	 * How far from the viewer the entity still gets drawn, in the
+	 *   camera's view or in shadow views (see render/vis.h);
+	 *   0 for no limit
+	 */
+	virtual float draw_dist (bool shadow) const
+	{ return 0.0; }
+
+	/*
+	 * Whether the entity's looks are already part of the world's
+	 *   geometry (see vis_bake_static_model), so that vis leaves it
+	 *   out of the octree
+	 */
+	virtual bool in_world_geometry () const
+	{ return false; }
+
 	/*
 	 * The entity promises that it is fully inside the box returned
 	 * Entities that have no physical appearance (ie logical ones)
@@ -89,6 +113,16 @@ class e_base
 	 */
 	virtual void moved ();
 
+	/*
+	 * The bounding box as of the latest moved(), and the tick of the
+	 *   latest one after the first, which only puts the entity in
+	 *   place; has_moved tells whether there has been one
+	 */
+	t_bound_box moved_bbox = { };
+	bool placed = false;
+	bool has_moved = false;
+	unsigned long long moved_tick = 0;
+
 	/* Used in vis to avoid redundant rendering */
 	uint64_t render_last_guard_key;
 };
@@ -2,6 +2,7 @@
 #include "render/render.h"
 #include "render/light/cone.h"
 #include "render/light/sun.h"
+#include "render/settings.h"
 
 std::vector<e_light_cone*> lights;
 
@@ -33,6 +34,9 @@ e_light_cone::e_light_cone ()
 
 e_light_cone::~e_light_cone ()
 {
+	light_cone_release_slot(this);
+	vis.free_occ_readback();
+
 	for (e_light_cone*& p: lights_cone) {
 		if (p == this) {
 			p = lights_cone.back();
@@ -48,8 +52,9 @@ void e_light_cone::moved ()
 	e_base::moved();
 
 	// update visible set
-	view();
-	vis.fill();
+	fill_vis();
+
+	shadow_valid = false;
 }
 
 
@@ -89,6 +94,15 @@ void e_light_cone::view () const
 	render_ctx.eye_pos = pos;
 }
 
+void e_light_cone::fill_vis ()
+{
+	view();
+	vis.fill();
+	vis.set_contribution(
+		render_ctx.proj[1][1] * cone_lspace_resolution * 0.5f,
+		true, pos);
+}
+
 /* ======================== e_light_sun code ======================== */
 
 SIG_HANDLER (light_sun, setcolor)
@@ -19,6 +19,15 @@ class e_light_cone: public e_base
 
 	t_visible_set vis;
 
+	/*
+	 * Shadow map caching (see render/light/cone.cpp): the slot in
+	 *   the atlas, whether what is in it is up to date, and which
+	 *   casters are left out of it to be drawn every frame
+	 */
+	int shadow_slot = -1;
+	bool shadow_valid = false;
+	std::vector<e_base*> shadow_dynamic;
+
 	e_light_cone ();
 	~e_light_cone ();
 
@@ -26,6 +35,9 @@ class e_light_cone: public e_base
 	virtual void moved ();
 
 	void view () const;
+
+	/* Set up the view, and fill vis for it */
+	void fill_vis ();
 };
 
 /*
@@ -1,5 +1,7 @@
 #include "prop.h"
 #include "render/resource.h"
+#include "render/instancing.h"
+#include "render/vis.h"
 #include "core/signal.h"
 
 FILL_IO_DATA (prop)
@@ -14,18 +16,60 @@ void e_prop::apply_keyvals (const t_ent_keyvals& kv)
 	apply_basic_keyvals(kv);
 
 	KV_TRY_GET(kv["model"],
-		model = get_model(val);,
-		model = get_model("error"); );
+		model_name = val;,
+		model_name = "error"; );
+	model = get_model(model_name);
+	KV_TRY_GET(kv["static"],
+		is_static = atoi(val.c_str());,
+		is_static = false; );
 	KV_TRY_GET(kv["mat"],
 		material = get_material(val);,
 		material = mat_none; );
+	impostor = is_static ? nullptr : get_impostor(model, material);
+	KV_TRY_GET(kv["fade_dist"],
+		fade_dist = atof(val.c_str());,
+		fade_dist = 0.0; );
+	KV_TRY_GET(kv["shadow_dist"],
+		shadow_dist = atof(val.c_str());,
+		shadow_dist = 0.0; );
+}
+
+void e_prop::moved ()
+{
+	model_matrix = glm::translate(mat4(1.0), pos);
+	model_matrix *= rotate_xyz_4x4(glm::radians(ang));
+
+	if (is_static) {
+		if (baked) {
+			warning("Static prop %s cannot move", name.c_str());
+			return;
+		}
+
+		vis_bake_static_model(model_name, material, model_matrix);
+		baked = true;
+		return;
+	}
+
+	e_base::moved();
+}
+
+bool e_prop::render_impostor () const
+{
+	if (impostor == nullptr || !impostor->baked
+	|| !impostor_wanted(get_bbox()))
+		return false;
+
+	impostors_add(impostor, render_ctx.model * model_matrix);
+	return true;
 }
 
 void e_prop::render () const
 {
+	if (render_impostor())
+		return;
+
 	mat4 restore = render_ctx.model;
-	render_ctx.model = glm::translate(render_ctx.model, pos);
-	render_ctx.model *= rotate_xyz_4x4(glm::radians(ang));
+	render_ctx.model *= model_matrix;
 
 	material->apply();
 	model->render();
@@ -33,11 +77,21 @@ void e_prop::render () const
 	render_ctx.model = restore;
 }
 
+bool e_prop::render_instanced (uint32_t layer_mask) const
+{
+	if (render_impostor())
+		return true;
+	instances_add(model, material, render_ctx.model * model_matrix,
+			layer_mask);
+	return true;
+}
+
+float e_prop::draw_dist (bool shadow) const
+{
+	return shadow ? shadow_dist : fade_dist;
+}
+
 t_bound_box e_prop::get_bbox () const
 {
-	// TODO: does not account for rotation
-	t_bound_box r = model->bbox;
-	r.start += pos;
-	r.end += pos;
-	return r;
+	return model->bbox.transformed(model_matrix);
 }
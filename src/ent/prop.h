@@ -5,6 +5,7 @@
 #include "render/render.h"
 #include "render/model.h"
 #include "render/material.h"
+#include "render/impostor.h"
 
 class e_prop: public e_base
 {
@@ -13,6 +14,34 @@ class e_prop: public e_base
 	t_model* model;
 	t_material* material;
 
+	/*
+	 * A static prop (keyval static 1) never moves, and so is baked
+	 *   into the world's geometry as the map loads, instead of
+	 *   being drawn as an entity
+	 */
+	bool is_static;
+	bool baked = false;
+	virtual bool in_world_geometry () const { return baked; }
+	std::string model_name;
+
+	/*
+	 * Drawn in place of the model when far away (null if static);
+	 *   render_impostor() queues it up if so, and tells whether it did
+	 */
+	t_impostor* impostor = nullptr;
+	bool render_impostor () const;
+
+	/* Translation and rotation, as of the latest moved() */
+	mat4 model_matrix = mat4(1.0);
+	virtual void moved ();
+
+	bool render_instanced (uint32_t layer_mask) const;
+
+	/* Keyvals fade_dist and shadow_dist, see e_base::draw_dist */
+	float fade_dist;
+	float shadow_dist;
+	float draw_dist (bool shadow) const;
+
 	ENT_MEMBERS (prop)
 };
 
@@ -27,16 +27,34 @@
  * locations specified in the respective lib shaders!
  */
 
-/* Main matrices */
+/* Main matrices, for the shaders which do not use the blocks below */
 constexpr int UNIFORM_LOC_PROJ = 100;
 constexpr int UNIFORM_LOC_VIEW = 116;
 constexpr int UNIFORM_LOC_MODEL = 132;
 
-/* The current render stage */
-constexpr int UNIFORM_LOC_RENDER_STAGE = 0;
+/* Uniform block binding points (internal/_uniforms.inc, render/ubo.h) */
+constexpr GLuint UBO_BINDING_FRAME = 0;
+constexpr GLuint UBO_BINDING_PASS = 1;
+constexpr GLuint UBO_BINDING_DRAW = 2;
+/* The lights of a clustered pass (internal/light/cone_clustered.frag) */
+constexpr GLuint UBO_BINDING_CONE_LIGHTS = 3;
 
-/* The tangent vector (TBN matrix calculation) */
+/*
+ * Generic vertex attributes (render/geometry.h, internal/_attribs.inc).
+ * The tangent vector is for the TBN matrix calculation
+ */
+constexpr GLuint ATTRIB_LOC_POSITION = 0;
 constexpr GLuint ATTRIB_LOC_TANGENT = 1;
+constexpr GLuint ATTRIB_LOC_NORMAL = 2;
+constexpr GLuint ATTRIB_LOC_TEXCOORD = 3;
+
+/* Layered rendering: per-layer view-projections and the caster's mask */
+constexpr int MAX_RENDER_LAYERS = 8;
+constexpr int UNIFORM_LOC_LAYER_VIEWPROJ = 148;
+constexpr GLuint ATTRIB_LOC_LAYER_MASK = 7;
+
+/* Instanced drawing: the model matrix, taking 8 through 11 */
+constexpr GLuint ATTRIB_LOC_INSTANCE_MODEL = 8;
 
 /* Vis cuboids */
 constexpr GLuint UNIFORM_LOC_VIS_CUBE = 42;
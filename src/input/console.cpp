@@ -147,23 +147,18 @@ void console_render ()
 	glDisable(GL_DEPTH_TEST);
 	glEnable(GL_BLEND);
 
-	glUseProgram(0);
-	glColor4ubv((GLubyte*) &bg_clr);
-	glRectf(-1.0, 1.0, 1.0, 1.0 - height);
+	draw_rect(-1.0, 1.0, 1.0, 1.0 - height, bg_clr);
 
-	glColor4ubv((GLubyte*) &cursor_clr);
-	glBegin(GL_LINES);
-	glVertex2f(-1.0 + text_x + text_width, 1.0 - text_y);
-	glVertex2f(-1.0 + text_x + text_width,
-	            1.0 - text_y - text_height);
-	glEnd();
+	draw_line(-1.0 + text_x + text_width, 1.0 - text_y,
+	          -1.0 + text_x + text_width, 1.0 - text_y - text_height,
+	          cursor_clr);
 
 	if (!matches.empty()) {
 		float single_match_h = text_height + 0.015;
 		float matches_h = single_match_h * matches.size();
 
-		glColor4ubv((GLubyte*) &bg_match_clr);
-		glRectf(-1.0, 1.0 - height, 1.0, 1.0 - height - matches_h);
+		draw_rect(-1.0, 1.0 - height, 1.0, 1.0 - height - matches_h,
+				bg_match_clr);
 
 		float matches_x = text_x + cmd_prefix.length() * char_width;
 
@@ -40,6 +40,8 @@ void warning (const char* format, ...);
 using glm::vec2;
 using glm::vec3;
 using glm::vec4;
+using glm::ivec2;
+using glm::ivec3;
 using glm::mat3;
 using glm::mat4;
 
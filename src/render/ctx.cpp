@@ -1,15 +1,12 @@
 #include "render/ctx.h"
 #include "render/render.h"
+#include "render/ubo.h"
 #include "input/cmds.h"
 
 void t_render_ctx::submit_matrices () const
 {
-	auto f = [] (GLuint loc, const mat4& m) -> void {
-		glUniformMatrix4fv(loc, 1, false, glm::value_ptr(m));
-	};
-	f(UNIFORM_LOC_PROJ, proj);
-	f(UNIFORM_LOC_VIEW, view);
-	f(UNIFORM_LOC_MODEL, model);
+	uniforms_submit_pass({ proj, view });
+	uniforms_submit_draw({ model });
 }
 
 void t_render_ctx::submit_viewproj () const
@@ -21,6 +18,12 @@ void t_render_ctx::submit_viewproj () const
 	f(UNIFORM_LOC_VIEW, view);
 }
 
+void t_render_ctx::submit_layers () const
+{
+	glUniformMatrix4fv(UNIFORM_LOC_LAYER_VIEWPROJ, num_layers, false,
+			glm::value_ptr(layer_viewproj[0]));
+}
+
 
 
 void t_camera::apply ()
@@ -13,6 +13,13 @@ enum t_render_stage: uint32_t
 
 	RENDER_STAGE_WIREFRAME = 3,
 
+	/* Depth only, ahead of the G-buffers (render/gbuffer.h) */
+	RENDER_STAGE_DEPTH_PREPASS = 4,
+
+	/* The visibility buffer, and resolving it (render/visbuf.h) */
+	RENDER_STAGE_VISIBILITY = 5,
+	RENDER_STAGE_VISBUF_RESOLVE = 6,
+
 	NUM_RENDER_STAGES
 };
 
@@ -26,11 +33,26 @@ struct t_render_ctx
 
 	vec3 eye_pos;
 
-	/* Set the matrices as their corresponding uniforms */
+	/*
+	 * Layered rendering: each triangle gets emitted into those of
+	 *   the layers that are set in ATTRIB_LOC_LAYER_MASK,
+	 *   transformed by the respective view-projection
+	 */
+	bool layered = false;
+	int num_layers = 0;
+	std::array<mat4, MAX_RENDER_LAYERS> layer_viewproj;
+
+	/* The model matrix comes per instance (render/instancing.h) */
+	bool instanced = false;
+
+	/* Stream the matrices into the pass and draw uniform blocks */
 	void submit_matrices () const;
 
-	/* Same, but without the model matrix */
+	/* Set projection and view as plain uniforms, for simple shaders */
 	void submit_viewproj () const;
+
+	/* The per-layer matrices, when rendering layered */
+	void submit_layers () const;
 };
 extern t_render_ctx render_ctx;
 
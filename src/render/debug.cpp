@@ -9,6 +9,9 @@ static constexpr int UNIFORM_LOC_LAYER = 4;
 static GLuint prog_tex2d;
 static GLuint prog_tex2d_array;
 
+/* The [0, 1] square, scaled and moved by the shader */
+static t_simple_vao quad;
+
 void init_render_debug ()
 {
 	prog_tex2d = make_glsl_program(
@@ -22,6 +25,10 @@ void init_render_debug ()
 		  get_frag_shader("internal/debug/tex2d_array") });
 	glUseProgram(prog_tex2d_array);
 	glUniform1i(UNIFORM_LOC_TEX, 0);
+
+	quad.make({ { ATTRIB_LOC_POSITION, 2 } })
+		.upload({ 0, 0, 0, 1, 1, 1,
+		          0, 0, 1, 1, 1, 0 });
 }
 
 void debug_render_tex2d (GLuint tex, float x, float y, float size)
@@ -33,12 +40,7 @@ void debug_render_tex2d (GLuint tex, float x, float y, float size)
 	bind_tex2d_to_slot(0, tex);
 	glUniform3f(UNIFORM_LOC_XY_SIZE, x, y, size);
 
-	glBegin(GL_QUADS);
-	glVertex2i(0, 0);
-	glVertex2i(0, 1);
-	glVertex2i(1, 1);
-	glVertex2i(1, 0);
-	glEnd();
+	quad.draw();
 }
 
 void debug_render_tex2d_array (GLuint tex, int layer,
@@ -51,10 +53,5 @@ void debug_render_tex2d_array (GLuint tex, int layer,
 	glUniform3f(UNIFORM_LOC_XY_SIZE, x, y, size);
 	glUniform1ui(UNIFORM_LOC_LAYER, layer);
 
-	glBegin(GL_QUADS);
-	glVertex2i(0, 0);
-	glVertex2i(0, 1);
-	glVertex2i(1, 1);
-	glVertex2i(1, 0);
-	glEnd();
+	quad.draw();
 }
@@ -19,6 +19,12 @@ t_fbo& t_fbo::make ()
 	return *this;
 }
 
+void t_fbo::destroy ()
+{
+	glDeleteFramebuffers(1, &id);
+	*this = t_fbo();
+}
+
 t_fbo& t_fbo::assert_complete ()
 {
 	glBindFramebuffer(GL_FRAMEBUFFER, id);
@@ -63,6 +69,11 @@ static void attach_low (t_fbo& fbo, t_fbo::t_attachment_ptr att,
 			GL_TEXTURE_2D_MULTISAMPLE, att->id, 0);
 		break;
 	case tex2d_array:
+		if (slice == ALL_SLICES) {
+			glFramebufferTexture(GL_FRAMEBUFFER, slot,
+				att->id, 0);
+			break;
+		}
 		glFramebufferTextureLayer(GL_FRAMEBUFFER, slot,
 			att->id, 0, slice);
 		break;
@@ -103,7 +114,11 @@ t_fbo& t_fbo::attach_depth (t_attachment* att, short slice)
 			id, depth->id, att->id);
 	}
 	depth = { att, slice };
-	attach_low(*this, depth, GL_DEPTH_ATTACHMENT, slice);
+
+	bool has_stencil = att->storage_type == GL_DEPTH24_STENCIL8
+	                || att->storage_type == GL_DEPTH32F_STENCIL8;
+	attach_low(*this, depth, has_stencil
+		? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, slice);
 	return *this;
 }
 
@@ -254,6 +269,36 @@ t_attachment* make_rbo_msaa (int w, int h, GLenum t, short samples)
 	return attachment_finalize(p);
 }
 
+void attachment_free (t_attachment* a)
+{
+	switch (a->target) {
+	case tex2d:
+	case tex2d_msaa:
+	case tex2d_array:
+	case tex2d_array_msaa:
+		glDeleteTextures(1, &a->id);
+		break;
+	case rbo:
+	case rbo_msaa:
+		glDeleteRenderbuffers(1, &a->id);
+		break;
+	}
+
+	delete a;
+}
+
+void attachment_set_compare (t_attachment* a, bool linear)
+{
+	assert(a->target == tex2d || a->target == tex2d_array);
+
+	GLenum filter = linear ? GL_LINEAR : GL_NEAREST;
+	glTextureParameteri(a->id, GL_TEXTURE_COMPARE_MODE,
+			GL_COMPARE_REF_TO_TEXTURE);
+	glTextureParameteri(a->id, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTextureParameteri(a->id, GL_TEXTURE_MAG_FILTER, filter);
+	glTextureParameteri(a->id, GL_TEXTURE_MIN_FILTER, filter);
+}
+
 /* ========================================================= */
 
 static std::vector<t_fbo*> ssbuffers;
@@ -74,9 +74,21 @@ t_attachment* make_rbo (int w, int h, GLenum internal_type);
 t_attachment* make_rbo_msaa (int w, int h,
 		GLenum internal_type, short samples);
 
+/* Delete the attachment along with its GL object */
+void attachment_free (t_attachment* a);
+
+/*
+ * Have a depth texture be sampled with comparison against a reference
+ * value (sampler2DShadow etc.), and whether to filter the results
+ */
+void attachment_set_compare (t_attachment* a, bool linear);
+
 /*
- * In all functions, slice only matters when the target is 3D
+ * In all functions, slice only matters when the target is 3D.
+ * Slice -1 attaches all of the slices at once, for layered rendering
  */
+constexpr short ALL_SLICES = -1;
+
 struct t_fbo
 {
 	GLuint id;
@@ -104,6 +116,9 @@ struct t_fbo
 	t_fbo& make ();
 	t_fbo& assert_complete ();
 
+	/* Delete the framebuffer, but not the attachments; back to unmade */
+	void destroy ();
+
 	t_fbo& attach_color (t_attachment* att, int idx = 0, short slice = 0);
 	t_fbo& attach_depth (t_attachment* att, short slice = 0);
 
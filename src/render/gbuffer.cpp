@@ -4,27 +4,61 @@
 #include "render/ctx.h"
 #include "render/vis.h"
 #include "render/debug.h"
+#include "render/resource.h"
+#include "render/light/all.h"
+#include "render/visbuf.h"
 #include "input/cmds.h"
 
 t_fbo gbuf_fbo;
 static GLuint gbuf_vao;
 static GLuint gbuf_vbo;
 
+bool gbuffer_composite = true;
+static GLuint composite_program;
+
+COMMAND_ROUTINE (render_composite)
+{
+	if (ev != PRESS || args.empty())
+		return;
+	gbuffer_composite = atoi(args[0].c_str());
+}
+
+bool gbuffer_depth_prepass = false;
+
+COMMAND_ROUTINE (render_depth_prepass)
+{
+	if (ev != PRESS || args.empty())
+		return;
+	gbuffer_depth_prepass = atoi(args[0].c_str());
+}
+
+/* Shades of red for how often each pixel got its material run */
+static bool overdraw_shown = false;
+static t_fbo overdraw_fbo;
+
+COMMAND_SET_BOOL (show_overdraw, overdraw_shown);
+
 void init_gbuffers ()
 {
 	int w = sdlctx.res_x;
 	int h = sdlctx.res_y;
 
 	gbuf_fbo.make()
-		.attach_color(make_tex2d(w, h, GL_RGB32F), GBUF_SLOT_WORLD_POS)
-		.attach_color(make_tex2d(w, h, GL_RGB16F),
-				GBUF_SLOT_WORLD_NORM)
-		.attach_color(make_tex2d(w, h, GL_R16F), GBUF_SLOT_SPECULAR)
-		.attach_depth(make_tex2d(w, h, GL_DEPTH_COMPONENT24))
+		.attach_color(make_tex2d(w, h, GL_RG16), GBUF_SLOT_NORMAL)
+		.attach_color(make_tex2d(w, h, GL_RGBA8), GBUF_SLOT_MATERIAL)
+		.attach_color(make_tex2d(w, h, GL_RGBA8), GBUF_SLOT_ALBEDO)
+		.attach_depth(make_tex2d(w, h, GL_DEPTH24_STENCIL8))
 		.assert_complete();
 
 	sspace_add_buffer(gbuf_fbo);
 
+	overdraw_fbo.make()
+		.attach_color(make_tex2d(w, h, GL_RGBA8))
+		.attach_depth(make_tex2d(w, h, GL_DEPTH_COMPONENT24))
+		.assert_complete();
+
+	sspace_add_buffer(overdraw_fbo);
+
 	glGenVertexArrays(1, &gbuf_vao);
 	glBindVertexArray(gbuf_vao);
 
@@ -40,22 +74,116 @@ void init_gbuffers ()
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
 			sizeof(vbo_contents[0]), (void*) 0);
+
+	composite_program = make_glsl_program(
+		{ get_vert_shader("internal/gbuffer_quad"),
+		  get_frag_shader("internal/composite") });
+	glUseProgram(composite_program);
+	gbuffer_set_samplers();
+	light_init_material();
+	glUniform1i(uniform_loc_gbuffer::albedo, 7);
+}
+
+/*
+ * Lay down the depth of the visible set alone, then leave the depth
+ *   test such that only the nearest surface in each pixel passes it
+ */
+static void depth_prepass ()
+{
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+	render_ctx.stage = RENDER_STAGE_DEPTH_PREPASS;
+	mesh_positions_only = true;
+	visible_set.render();
+	mesh_positions_only = false;
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthFunc(GL_EQUAL);
+	glDepthMask(GL_FALSE);
+}
+
+/*
+ * Run the G-buffer pass again, with the same depth test, but adding
+ *   1/8 to the red for every fragment which would get shaded
+ */
+static void measure_overdraw ()
+{
+	overdraw_fbo.apply();
+
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+	if (gbuffer_depth_prepass)
+		depth_prepass();
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_CONSTANT_COLOR, GL_ONE);
+	glBlendColor(0.125, 0.125, 0.125, 0.125);
+
+	render_ctx.stage = RENDER_STAGE_WIREFRAME;
+	visible_set.render();
+
+	glDisable(GL_BLEND);
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
 }
 
 void fill_gbuffers ()
 {
 	gbuf_fbo.apply();
 
+	// the albedo only gets written for the composite
+	GLenum albedo = gbuffer_composite ? GL_COLOR_ATTACHMENT2 : GL_NONE;
+	gbuf_fbo.set_mrt_slots(
+		{ GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, albedo });
+
 	glClearColor(0.0, 0.0, 0.0, 1.0);
 	glClearDepth(1.0);
-	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+	glClearStencil(0);
+	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT
+			| GL_STENCIL_BUFFER_BIT);
 
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 	glDisable(GL_BLEND);
 
+	if (visbuf_enabled) {
+		visbuf_fill();
+		return;
+	}
+
+	if (gbuffer_depth_prepass)
+		depth_prepass();
+
 	render_ctx.stage = RENDER_STAGE_G_BUFFERS;
 	visible_set.render();
+
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+
+	if (overdraw_shown)
+		measure_overdraw();
+}
+
+/* The slots the G-buffer's textures go to */
+constexpr int slot_normal = 4;
+constexpr int slot_material = 5;
+constexpr int slot_depth = 6;
+
+void gbuffer_set_samplers ()
+{
+	using namespace uniform_loc_gbuffer;
+	glUniform1i(normal, slot_normal);
+	glUniform1i(material, slot_material);
+	glUniform1i(screen_depth, slot_depth);
+}
+
+void gbuffer_bind_textures ()
+{
+	bind_tex2d_to_slot(slot_normal, gbuf_fbo.color[GBUF_SLOT_NORMAL]->id);
+	bind_tex2d_to_slot(slot_material,
+			gbuf_fbo.color[GBUF_SLOT_MATERIAL]->id);
+	bind_tex2d_to_slot(slot_depth, gbuf_fbo.depth->id);
 }
 
 void gbuffer_pass ()
@@ -64,6 +192,22 @@ void gbuffer_pass ()
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 }
 
+void gbuffer_composite_pass ()
+{
+	material_barrier();
+	glUseProgram(composite_program);
+
+	gbuffer_bind_textures();
+	light_apply_material();
+	bind_tex2d_to_slot(7, gbuf_fbo.color[GBUF_SLOT_ALBEDO]->id);
+
+	// the depth gets written too, for whatever is drawn later on
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_ALWAYS);
+	gbuffer_pass();
+	glDepthFunc(GL_LESS);
+}
+
 static int show_gbuffer = -1;
 COMMAND_ROUTINE (show_gbuf)
 {
@@ -78,7 +222,10 @@ COMMAND_ROUTINE (show_gbuf)
 
 void debug_show_gbuffers ()
 {
-	if (show_gbuffer >= 0) {
+	if (overdraw_shown) {
+		debug_render_tex2d(overdraw_fbo.color[0]->id,
+				-1.0, -1.0, 2.0);
+	} else if (show_gbuffer >= 0) {
 		debug_render_tex2d(gbuf_fbo.color[show_gbuffer]->id,
 				-1.0, -1.0, 2.0);
 	}
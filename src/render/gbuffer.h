@@ -5,10 +5,13 @@
 
 /*
  * G-buffer layout:
- *  depth             depth in screenspace
- *  color 0    RGB    position in worldspace
- *  color 1    RGB    normals in worldspace
- *  color 2    R      specular exponent
+ *  depth             depth in screenspace, with stencil for lights;
+ *                    the position in worldspace is got back from it
+ *  color 0    RG16   normals in worldspace, octahedral packed
+ *                    into [-1, 1] and then stored in [0, 1]
+ *  color 1    RGBA8  R specular exponent / 255, GBA unused yet
+ *  color 2    RGBA8  surface_color(), only written with gbuffer_composite
+ * See internal/_gbuffer.inc for reading it
  */
 
 extern t_fbo gbuf_fbo;
@@ -19,16 +22,40 @@ void gbuffer_pass ();
 
 void debug_show_gbuffers ();
 
-constexpr int GBUF_SLOT_WORLD_POS = 0;
-constexpr int GBUF_SLOT_WORLD_NORM = 1;
-constexpr int GBUF_SLOT_SPECULAR = 2;
+constexpr int GBUF_SLOT_NORMAL = 0;
+constexpr int GBUF_SLOT_MATERIAL = 1;
+constexpr int GBUF_SLOT_ALBEDO = 2;
 
 namespace uniform_loc_gbuffer
 {
-	constexpr int world_pos = 200;
-	constexpr int world_norm = 201;
+	constexpr int normal = 201;
 	constexpr int screen_depth = 202;
-	constexpr int specular = 203;
+	constexpr int material = 203;
+	constexpr int albedo = 204;
 }
 
+/*
+ * With gbuffer_composite, the materials' colors go into the G-buffer
+ *   along with the rest, and the final image is made by one screenspace
+ *   pass out of that and the light, instead of rendering all of the
+ *   geometry again in RENDER_STAGE_SHADE_FINAL
+ */
+extern bool gbuffer_composite;
+void gbuffer_composite_pass ();
+
+/*
+ * With gbuffer_depth_prepass, the visible set is drawn depth only
+ *   first (position only meshes, no fragment shader), and the G-buffer
+ *   pass then tests GL_EQUAL without writing, so each pixel runs one
+ *   material at most. show_overdraw tells whether it pays off
+ */
+extern bool gbuffer_depth_prepass;
+
+/*
+ * For screenspace passes: point the samplers of the program in use
+ *   at the texture slots for the G-buffer, and bind it to them
+ */
+void gbuffer_set_samplers ();
+void gbuffer_bind_textures ();
+
 #endif // GBUFFER_H
@@ -0,0 +1,138 @@
+#include "render/geometry.h"
+#include <cstddef>
+
+t_frame_stats frame_stats;
+t_frame_stats last_frame_stats;
+
+bool mesh_positions_only = false;
+bool mesh_visbuf_recording = false;
+
+static void mesh_attribs (GLuint vao)
+{
+	auto attrib = [vao] (GLuint loc, int size, size_t offset) -> void {
+		glEnableVertexArrayAttrib(vao, loc);
+		glVertexArrayAttribFormat(vao, loc, size,
+				GL_FLOAT, GL_FALSE, offset);
+		glVertexArrayAttribBinding(vao, loc, 0);
+	};
+	attrib(ATTRIB_LOC_POSITION, 3, offsetof(t_mesh_vertex, pos));
+	attrib(ATTRIB_LOC_NORMAL, 3, offsetof(t_mesh_vertex, norm));
+	attrib(ATTRIB_LOC_TEXCOORD, 2, offsetof(t_mesh_vertex, tex));
+	attrib(ATTRIB_LOC_TANGENT, 3, offsetof(t_mesh_vertex, tangent));
+}
+
+void t_mesh::load (const std::vector<t_mesh_vertex>& vertices,
+		const std::vector<uint32_t>& indices)
+{
+	glCreateBuffers(1, &vbo);
+	glNamedBufferStorage(vbo, sizeof(vertices[0]) * vertices.size(),
+			vertices.data(), 0);
+
+	glCreateBuffers(1, &ibo);
+	glNamedBufferStorage(ibo, sizeof(indices[0]) * indices.size(),
+			indices.data(), 0);
+	num_indices = indices.size();
+
+	glCreateVertexArrays(1, &vao);
+	glVertexArrayVertexBuffer(vao, 0, vbo, 0, sizeof(t_mesh_vertex));
+	glVertexArrayElementBuffer(vao, ibo);
+	mesh_attribs(vao);
+
+	std::vector<vec3> positions(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+		positions[i] = vertices[i].pos;
+
+	glCreateBuffers(1, &pos_vbo);
+	glNamedBufferStorage(pos_vbo, sizeof(positions[0]) * positions.size(),
+			positions.data(), 0);
+
+	glCreateVertexArrays(1, &pos_vao);
+	glVertexArrayVertexBuffer(pos_vao, 0, pos_vbo, 0, sizeof(vec3));
+	glVertexArrayElementBuffer(pos_vao, ibo);
+	glEnableVertexArrayAttrib(pos_vao, ATTRIB_LOC_POSITION);
+	glVertexArrayAttribFormat(pos_vao, ATTRIB_LOC_POSITION, 3,
+			GL_FLOAT, GL_FALSE, 0);
+	glVertexArrayAttribBinding(pos_vao, ATTRIB_LOC_POSITION, 0);
+}
+
+void t_mesh::bind_instanced (GLuint buffer, GLintptr offset) const
+{
+	if (instanced_vao == 0) {
+		GLuint v;
+		glCreateVertexArrays(1, &v);
+		glVertexArrayVertexBuffer(v, 0, vbo, 0,
+				sizeof(t_mesh_vertex));
+		glVertexArrayElementBuffer(v, ibo);
+		mesh_attribs(v);
+
+		// the model matrix takes a location per column
+		for (int i = 0; i < 4; i++) {
+			GLuint loc = ATTRIB_LOC_INSTANCE_MODEL + i;
+			glEnableVertexArrayAttrib(v, loc);
+			glVertexArrayAttribFormat(v, loc, 4, GL_FLOAT,
+				GL_FALSE, offsetof(t_instance, model)
+				          + i * sizeof(vec4));
+			glVertexArrayAttribBinding(v, loc, 1);
+		}
+
+		glEnableVertexArrayAttrib(v, ATTRIB_LOC_LAYER_MASK);
+		glVertexArrayAttribIFormat(v, ATTRIB_LOC_LAYER_MASK, 1,
+			GL_UNSIGNED_INT, offsetof(t_instance, layer_mask));
+		glVertexArrayAttribBinding(v, ATTRIB_LOC_LAYER_MASK, 1);
+
+		glVertexArrayBindingDivisor(v, 1, 1);
+		instanced_vao = v;
+	}
+
+	glVertexArrayVertexBuffer(instanced_vao, 1, buffer, offset,
+			sizeof(t_instance));
+	glBindVertexArray(instanced_vao);
+}
+
+void t_mesh::free ()
+{
+	glDeleteVertexArrays(1, &instanced_vao);
+	glDeleteVertexArrays(1, &vao);
+	glDeleteVertexArrays(1, &pos_vao);
+	glDeleteTextures(1, &vertex_tex);
+	glDeleteTextures(1, &index_tex);
+	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &pos_vbo);
+	glDeleteBuffers(1, &ibo);
+	*this = t_mesh();
+}
+
+
+t_simple_vao& t_simple_vao::make (std::initializer_list<t_attrib> attribs)
+{
+	glCreateBuffers(1, &vbo);
+	glCreateVertexArrays(1, &vao);
+
+	int offset = 0;
+	for (const t_attrib& a: attribs) {
+		glEnableVertexArrayAttrib(vao, a.location);
+		glVertexArrayAttribFormat(vao, a.location, a.size,
+				GL_FLOAT, GL_FALSE, offset * sizeof(float));
+		glVertexArrayAttribBinding(vao, a.location, 0);
+		offset += a.size;
+	}
+
+	stride = offset * sizeof(float);
+	glVertexArrayVertexBuffer(vao, 0, vbo, 0, stride);
+	return *this;
+}
+
+t_simple_vao& t_simple_vao::upload (const std::vector<float>& data)
+{
+	// orphans whatever was there before
+	glNamedBufferData(vbo, sizeof(data[0]) * data.size(),
+			data.data(), GL_STREAM_DRAW);
+	num_vertices = data.size() * sizeof(float) / stride;
+	return *this;
+}
+
+void t_simple_vao::draw (GLenum mode) const
+{
+	glBindVertexArray(vao);
+	glDrawArrays(mode, 0, num_vertices);
+}
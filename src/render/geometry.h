@@ -0,0 +1,160 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include "inc_gl.h"
+#include "misc.h"
+#include <initializer_list>
+#include <vector>
+
+/*
+ * Buffer-backed geometry, in place of display lists and immediate mode.
+ * Attributes go to the generic locations ATTRIB_LOC_*, which the
+ *   shaders declare explicitly (see internal/_attribs.inc)
+ */
+
+/*
+ * Counted over the frame being rendered; the previous frame's
+ *   are kept in last_frame_stats (see render_stats)
+ */
+struct t_frame_stats
+{
+	int draw_calls;
+
+	/* Instanced draw calls, out of the above, and what they drew */
+	int instanced_draws;
+	int instances;
+
+	/* World buckets not drawn for facing away (render/vis.h) */
+	int clusters_culled;
+
+	/* Buckets and entities too small or far to draw (same) */
+	int contrib_culled;
+
+	/* Entities in visible leaves, but outside the view or occluded */
+	int entities_outside;
+	int entities_occluded;
+
+	/* Props drawn as impostors (render/impostor.h) */
+	int impostors;
+
+	/* Screenspace light passes, of all kinds (render/light/all.h) */
+	int light_passes;
+};
+extern t_frame_stats frame_stats;
+extern t_frame_stats last_frame_stats;
+
+/* A vertex of a mesh as it is stored in the buffer, interleaved */
+struct t_mesh_vertex
+{
+	vec3 pos;
+	vec3 norm;
+	vec2 tex;
+	vec3 tangent;
+};
+
+/* Per instance attributes, ATTRIB_LOC_INSTANCE_* */
+struct t_instance
+{
+	mat4 model;
+	uint32_t layer_mask;
+};
+
+/*
+ * While set, meshes bind their position only stream instead: passes
+ *   which need nothing but the depth fetch a third of the data
+ */
+extern bool mesh_positions_only;
+
+/*
+ * While set, non instanced draws go through visbuf_draw instead, which
+ *   gives them their IDs in the visibility buffer (render/visbuf.h)
+ */
+extern bool mesh_visbuf_recording;
+struct t_mesh;
+void visbuf_draw (const t_mesh& mesh, int first, int count);
+
+/*
+ * Indexed triangles: a VBO, an IBO and the VAO binding them.
+ * The positions get a tightly packed VBO and VAO of their own, for
+ *   the depth only passes.
+ * The instanced VAO has per instance attributes as well, and only
+ *   gets made once the mesh is first drawn instanced
+ */
+struct t_mesh
+{
+	GLuint vao = 0;
+	GLuint vbo = 0;
+	GLuint ibo = 0;
+	int num_indices = 0;
+
+	GLuint pos_vao = 0;
+	GLuint pos_vbo = 0;
+
+	mutable GLuint instanced_vao = 0;
+
+	/* Texture buffer views of vbo and ibo, for the visibility buffer */
+	mutable GLuint vertex_tex = 0;
+	mutable GLuint index_tex = 0;
+
+	void load (const std::vector<t_mesh_vertex>& vertices,
+			const std::vector<uint32_t>& indices);
+	void free ();
+
+	void bind () const
+	{
+		glBindVertexArray(mesh_positions_only ? pos_vao : vao);
+	}
+
+	/* Draw count indices from first on; the mesh must be bound */
+	void draw (int first, int count) const
+	{
+		if (mesh_visbuf_recording) {
+			visbuf_draw(*this, first, count);
+			return;
+		}
+		glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT,
+			(const void*) (first * sizeof(uint32_t)));
+		frame_stats.draw_calls++;
+	}
+
+	/* Bind, taking t_instances from the buffer, starting at offset */
+	void bind_instanced (GLuint buffer, GLintptr offset) const;
+
+	void draw_instanced (int first, int count, int num_instances) const
+	{
+		glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_INT,
+			(const void*) (first * sizeof(uint32_t)),
+			num_instances);
+		frame_stats.draw_calls++;
+		frame_stats.instanced_draws++;
+		frame_stats.instances += num_instances;
+	}
+};
+
+/*
+ * Non-indexed vertices of plain float attributes, for the engine's
+ *   own simple geometry (cuboids, screen quads, text, etc.)
+ */
+struct t_simple_vao
+{
+	/* Attribute location and its number of floats */
+	struct t_attrib {
+		GLuint location;
+		int size;
+	};
+
+	GLuint vao = 0;
+	GLuint vbo = 0;
+	int num_vertices = 0;
+	int stride = 0;
+
+	/* The attributes are interleaved in the order given */
+	t_simple_vao& make (std::initializer_list<t_attrib> attribs);
+
+	/* Replace the contents; fine to do every frame */
+	t_simple_vao& upload (const std::vector<float>& data);
+
+	void draw (GLenum mode = GL_TRIANGLES) const;
+};
+
+#endif // GEOMETRY_H
@@ -0,0 +1,273 @@
+#include "render/impostor.h"
+#include "render/gbuffer.h"
+#include "render/visbuf.h"
+#include "render/render.h"
+#include "render/resource.h"
+#include "render/light/all.h"
+#include "input/cmds.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+
+float impostor_dist = 300.0;
+
+/* 0 for never */
+COMMAND_ROUTINE (impostor_dist)
+{
+	if (ev == PRESS && !args.empty())
+		impostor_dist = atof(args[0].c_str());
+}
+
+static std::map<std::pair<const t_model*, const t_material*>,
+                std::unique_ptr<t_impostor>> impostors;
+
+struct t_queued_impostor
+{
+	const t_impostor* imp;
+	t_instance inst;
+};
+
+static std::vector<t_queued_impostor> queue;
+static std::vector<t_instance> instance_data;
+static GLuint instance_buffer = 0;
+
+/* A square on the XY plane, as corners in [-1, 1] */
+static t_mesh quad;
+
+/* By render stage: the G-buffers, with and without the albedo, and final */
+static GLuint program_gbuffers;
+static GLuint program_gbuffers_albedo;
+static GLuint program_final;
+
+/* Past those of the materials' bitmaps */
+constexpr int slot_normal = 10;
+constexpr int slot_material = 11;
+constexpr int slot_albedo = 12;
+constexpr int slot_depth = 13;
+
+static GLuint make_program (t_render_stage stage, bool albedo)
+{
+	std::string defines = "#define STAGE " + std::to_string(stage) + "\n";
+	if (albedo)
+		defines += "#define GBUF_ALBEDO\n";
+
+	GLuint p = make_glsl_program(
+		{ get_vert_shader("internal/impostor", defines),
+		  get_frag_shader("internal/impostor", defines) });
+
+	namespace loc = uniform_loc_impostor;
+	glUseProgram(p);
+	glUniform1i(loc::normal, slot_normal);
+	glUniform1i(loc::material, slot_material);
+	glUniform1i(loc::albedo, slot_albedo);
+	glUniform1i(loc::depth, slot_depth);
+	if (stage == RENDER_STAGE_SHADE_FINAL)
+		light_init_material();
+	return p;
+}
+
+void init_impostors ()
+{
+	std::vector<t_mesh_vertex> vertices;
+	for (vec2 c: { vec2(-1.0, -1.0), vec2(1.0, -1.0),
+	               vec2(1.0, 1.0), vec2(-1.0, 1.0) }) {
+		vertices.push_back({ vec3(c, 0.0), vec3(0.0, 0.0, 1.0),
+			c * 0.5f + 0.5f, vec3(1.0, 0.0, 0.0) });
+	}
+	quad.load(vertices, { 0, 1, 2, 0, 2, 3 });
+
+	program_gbuffers = make_program(RENDER_STAGE_G_BUFFERS, false);
+	program_gbuffers_albedo = make_program(RENDER_STAGE_G_BUFFERS, true);
+	program_final = make_program(RENDER_STAGE_SHADE_FINAL, false);
+}
+
+t_impostor* get_impostor (const t_model* mdl, const t_material* mat)
+{
+	auto& p = impostors[{ mdl, mat }];
+	if (p == nullptr) {
+		p = std::make_unique<t_impostor>();
+		p->model = mdl;
+		p->material = mat;
+		p->centre = (mdl->bbox.start + mdl->bbox.end) * 0.5f;
+		p->radius = glm::length(mdl->bbox.end - mdl->bbox.start) * 0.5f;
+	}
+	return p.get();
+}
+
+/*
+ * Each view looks at the centre from the direction at its angle about
+ *   Z, through an orthographic projection spanning the bounding sphere:
+ *   depth 0 is on the sphere's near side, and 1 on the far side
+ */
+static void bake (t_impostor& imp)
+{
+	int w = IMPOSTOR_CELL_SIZE * IMPOSTOR_VIEWS;
+	int h = IMPOSTOR_CELL_SIZE;
+
+	imp.atlas.make()
+		.attach_color(make_tex2d(w, h, GL_RG16), GBUF_SLOT_NORMAL)
+		.attach_color(make_tex2d(w, h, GL_RGBA8), GBUF_SLOT_MATERIAL)
+		.attach_color(make_tex2d(w, h, GL_RGBA8), GBUF_SLOT_ALBEDO)
+		.attach_depth(make_tex2d(w, h, GL_DEPTH_COMPONENT24))
+		.set_mrt_slots({ GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+		                 GL_COLOR_ATTACHMENT2 })
+		.assert_complete();
+
+	imp.atlas.apply();
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClearDepth(1.0);
+	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+	float r = imp.radius;
+	for (int v = 0; v < IMPOSTOR_VIEWS; v++) {
+		float a = glm::two_pi<float>() * v / IMPOSTOR_VIEWS;
+		vec3 dir = { std::cos(a), std::sin(a), 0.0 };
+
+		glViewport(v * IMPOSTOR_CELL_SIZE, 0, IMPOSTOR_CELL_SIZE,
+				IMPOSTOR_CELL_SIZE);
+		render_ctx.view = glm::lookAt(imp.centre + dir * 2.0f * r,
+				imp.centre, vec3(0.0, 0.0, 1.0));
+		render_ctx.proj = glm::ortho(-r, r, -r, r, r, 3.0f * r);
+
+		imp.material->apply();
+		imp.model->render();
+	}
+
+	imp.baked = true;
+}
+
+void impostors_bake ()
+{
+	restorer rest(render_ctx);
+	restorer rest_composite(gbuffer_composite);
+
+	// the atlas always takes the albedo
+	gbuffer_composite = true;
+	render_ctx.stage = RENDER_STAGE_G_BUFFERS;
+	render_ctx.model = mat4(1.0);
+	render_ctx.layered = false;
+	render_ctx.instanced = false;
+
+	bool any = false;
+	for (auto& [key, imp]: impostors) {
+		if (imp->baked)
+			continue;
+
+		if (!any) {
+			glEnable(GL_DEPTH_TEST);
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+			glEnable(GL_CULL_FACE);
+			glDisable(GL_BLEND);
+			material_barrier();
+			any = true;
+		}
+		bake(*imp);
+	}
+
+	if (any)
+		material_barrier();
+}
+
+bool impostor_wanted (const t_bound_box& b)
+{
+	if (impostor_dist <= 0.0 || render_ctx.layered)
+		return false;
+
+	// the draws there must be the models themselves
+	if (visbuf_enabled || mesh_visbuf_recording)
+		return false;
+
+	switch (render_ctx.stage) {
+	case RENDER_STAGE_G_BUFFERS:
+	case RENDER_STAGE_DEPTH_PREPASS:
+	case RENDER_STAGE_SHADE_FINAL:
+		break;
+	default:
+		return false;
+	}
+
+	vec3 eye = render_ctx.eye_pos;
+	return glm::distance(glm::clamp(eye, b.start, b.end), eye)
+	     > impostor_dist;
+}
+
+void impostors_add (const t_impostor* imp, const mat4& model)
+{
+	// left out: the impostors write their depth in the G-buffer pass
+	if (render_ctx.stage == RENDER_STAGE_DEPTH_PREPASS)
+		return;
+	queue.push_back({ imp, { model, 0 } });
+}
+
+void impostors_flush ()
+{
+	namespace loc = uniform_loc_impostor;
+
+	if (queue.empty())
+		return;
+
+	std::stable_sort(queue.begin(), queue.end(),
+		[] (const t_queued_impostor& a, const t_queued_impostor& b) {
+			return a.imp < b.imp;
+		});
+
+	instance_data.clear();
+	for (const t_queued_impostor& q: queue)
+		instance_data.push_back(q.inst);
+
+	if (instance_buffer == 0)
+		glCreateBuffers(1, &instance_buffer);
+	glNamedBufferData(instance_buffer,
+			sizeof(t_instance) * instance_data.size(),
+			instance_data.data(), GL_STREAM_DRAW);
+
+	bool final = render_ctx.stage == RENDER_STAGE_SHADE_FINAL;
+	GLuint program = final ? program_final
+		: gbuffer_composite ? program_gbuffers_albedo
+		: program_gbuffers;
+
+	glUseProgram(program);
+	material_barrier();
+
+	restorer rest(render_ctx);
+	render_ctx.model = mat4(1.0);
+	render_ctx.submit_matrices();
+	if (final)
+		light_apply_material();
+
+	// the pre-pass did not have them, so they must test on their own
+	bool after_prepass = !final && gbuffer_depth_prepass;
+	if (after_prepass) {
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+	}
+
+	for (size_t i = 0, j; i < queue.size(); i = j) {
+		const t_impostor* imp = queue[i].imp;
+		for (j = i + 1; j < queue.size(); j++) {
+			if (queue[j].imp != imp)
+				break;
+		}
+
+		const t_fbo& a = imp->atlas;
+		bind_tex2d_to_slot(slot_normal, a.color[GBUF_SLOT_NORMAL]->id);
+		bind_tex2d_to_slot(slot_material,
+				a.color[GBUF_SLOT_MATERIAL]->id);
+		bind_tex2d_to_slot(slot_albedo, a.color[GBUF_SLOT_ALBEDO]->id);
+		bind_tex2d_to_slot(slot_depth, a.depth->id);
+		glUniform3fv(loc::centre, 1, glm::value_ptr(imp->centre));
+		glUniform1f(loc::radius, imp->radius);
+
+		quad.bind_instanced(instance_buffer, i * sizeof(t_instance));
+		quad.draw_instanced(0, quad.num_indices, j - i);
+		frame_stats.impostors += j - i;
+	}
+
+	if (after_prepass) {
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+
+	queue.clear();
+}
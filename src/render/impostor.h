@@ -0,0 +1,70 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include "render/framebuffer.h"
+#include "render/model.h"
+#include "render/material.h"
+
+/*
+ * Impostors: props farther from the camera than impostor_dist get
+ *   drawn as a single quad instead of their model.
+ * Every pair of model and material in use gets rendered once, from
+ *   IMPOSTOR_VIEWS directions around its vertical axis, into an atlas
+ *   laid out like the G-buffer (render/gbuffer.h), only with normals
+ *   in model space, and the albedo always there; plus its depth.
+ * The quad faces whichever of the directions is nearest to that of
+ *   the camera, and writes the G-buffer out of the atlas, depth and
+ *   all, so the lights see about what the model would have given.
+ * Only the camera's G-buffer and final shading passes use them: the
+ *   shadows take the models, and the depth pre-pass and the visibility
+ *   buffer leave the far props out, or draw them whole, respectively
+ */
+struct t_impostor
+{
+	const t_model* model;
+	const t_material* material;
+
+	/* The bounding sphere, in model space */
+	vec3 centre;
+	float radius;
+
+	/* Colors 0 to 2 as in the G-buffer, and the depth */
+	t_fbo atlas;
+	bool baked = false;
+};
+
+extern float impostor_dist;
+
+void init_impostors ();
+
+/* The impostor for the pair; it gets baked by impostors_bake() */
+t_impostor* get_impostor (const t_model* mdl, const t_material* mat);
+
+/* Render the atlases of those which have not been yet */
+void impostors_bake ();
+
+/* Whether a prop in the box should be drawn as its impostor now */
+bool impostor_wanted (const t_bound_box& b);
+
+/*
+ * Queued up like instances (render/instancing.h), and drawn by
+ *   impostors_flush() at the end of the pass
+ */
+void impostors_add (const t_impostor* imp, const mat4& model);
+void impostors_flush ();
+
+/* The shaders get IMPOSTOR_VIEWS #defined, see render/settings.h */
+constexpr int IMPOSTOR_VIEWS = 8;
+constexpr int IMPOSTOR_CELL_SIZE = 128;
+
+namespace uniform_loc_impostor
+{
+	constexpr int centre = 230;
+	constexpr int radius = 231;
+	constexpr int normal = 232;
+	constexpr int material = 233;
+	constexpr int albedo = 234;
+	constexpr int depth = 235;
+}
+
+#endif // IMPOSTOR_H
@@ -0,0 +1,67 @@
+#include "render/instancing.h"
+#include "render/render.h"
+#include "input/cmds.h"
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+bool instancing_disabled = false;
+COMMAND_SET_BOOL (render_no_instancing, instancing_disabled);
+
+struct t_queued_instance
+{
+	const t_material* mat;
+	const t_model* mdl;
+	t_instance inst;
+};
+
+static std::vector<t_queued_instance> queue;
+static std::vector<t_instance> instance_data;
+static GLuint instance_buffer = 0;
+
+void instances_add (const t_model* mdl, const t_material* mat,
+		const mat4& model, uint32_t layer_mask)
+{
+	queue.push_back({ mat, mdl, { model, layer_mask } });
+}
+
+void instances_flush ()
+{
+	if (queue.empty())
+		return;
+
+	// by material first, so that programs switch less often
+	std::stable_sort(queue.begin(), queue.end(),
+		[] (const t_queued_instance& a, const t_queued_instance& b) {
+			return std::tie(a.mat, a.mdl) < std::tie(b.mat, b.mdl);
+		});
+
+	instance_data.clear();
+	for (const t_queued_instance& q: queue)
+		instance_data.push_back(q.inst);
+
+	if (instance_buffer == 0)
+		glCreateBuffers(1, &instance_buffer);
+	glNamedBufferData(instance_buffer,
+			sizeof(t_instance) * instance_data.size(),
+			instance_data.data(), GL_STREAM_DRAW);
+
+	restorer rest(render_ctx);
+	render_ctx.model = mat4(1.0);
+	render_ctx.instanced = true;
+
+	for (size_t i = 0, j; i < queue.size(); i = j) {
+		const t_queued_instance& q = queue[i];
+		for (j = i + 1; j < queue.size(); j++) {
+			if (queue[j].mat != q.mat || queue[j].mdl != q.mdl)
+				break;
+		}
+
+		const t_mesh& mesh = q.mdl->mesh;
+		q.mat->apply();
+		mesh.bind_instanced(instance_buffer, i * sizeof(t_instance));
+		mesh.draw_instanced(0, mesh.num_indices, j - i);
+	}
+
+	queue.clear();
+}
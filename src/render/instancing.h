@@ -0,0 +1,21 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include "render/model.h"
+#include "render/material.h"
+
+/*
+ * Props that share a model and a material get drawn together, with
+ *   one glDrawElementsInstanced, their transforms and layer masks
+ *   being in an instance buffer.
+ * Instances are queued up during a pass, and drawn all at once
+ *   by instances_flush() at the end of it
+ */
+void instances_add (const t_model* mdl, const t_material* mat,
+		const mat4& model, uint32_t layer_mask);
+void instances_flush ();
+
+/* Draw every entity by itself instead, for comparison */
+extern bool instancing_disabled;
+
+#endif // INSTANCING_H
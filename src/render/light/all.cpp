@@ -8,10 +8,20 @@
 #include "render/gbuffer.h"
 #include "input/cmds.h"
 #include "misc.h"
+#include <algorithm>
 
-t_fbo sspace_fbo[2];
-int current_sspace_fbo;
+t_fbo sspace_fbo;
+t_fbo sspace_fbo_bounded;
 vec3 light_ambience;
+float light_gpu_time = 0.0;
+
+/*
+ * Read a frame late, so as to not wait for the GPU; a query only has
+ *   a result to wait for once it has been issued
+ */
+static GLuint timer_query[2];
+static bool timer_issued[2] = { false, false };
+static int timer_current = 0;
 
 /* TODO: do anything useful in post-processing */
 
@@ -21,13 +31,22 @@ void init_lighting ()
 	int h = sdlctx.res_y;
 	constexpr GLenum f = GL_R11F_G11F_B10F;
 
-	for (int i: { 0, 1 }) {
-		sspace_fbo[i].make()
-			.attach_color(make_tex2d(w, h, f), LIGHT_SLOT_DIFFUSE)
-			.attach_color(make_tex2d(w, h, f), LIGHT_SLOT_SPECULAR)
-			.assert_complete();
-		sspace_add_buffer(sspace_fbo[i]);
-	}
+	sspace_fbo.make()
+		.attach_color(make_tex2d(w, h, f), LIGHT_SLOT_DIFFUSE)
+		.attach_color(make_tex2d(w, h, f), LIGHT_SLOT_SPECULAR)
+		.assert_complete();
+	sspace_add_buffer(sspace_fbo);
+
+	sspace_fbo_bounded.make()
+		.attach_color(sspace_fbo.color[LIGHT_SLOT_DIFFUSE].ptr,
+				LIGHT_SLOT_DIFFUSE)
+		.attach_color(sspace_fbo.color[LIGHT_SLOT_SPECULAR].ptr,
+				LIGHT_SLOT_SPECULAR)
+		.attach_depth(make_tex2d(w, h, GL_DEPTH24_STENCIL8))
+		.assert_complete();
+	sspace_add_buffer(sspace_fbo_bounded);
+
+	glGenQueries(2, timer_query);
 
 	init_lighting_cone();
 	init_lighting_sun();
@@ -35,8 +54,28 @@ void init_lighting ()
 
 void compute_all_lighting ()
 {
-	current_sspace_fbo = 0;
-	sspace_fbo[0].apply();
+	GLuint done = timer_query[timer_current ^ 1];
+	GLint available = 0;
+	if (timer_issued[timer_current ^ 1]) {
+		glGetQueryObjectiv(done, GL_QUERY_RESULT_AVAILABLE,
+				&available);
+	}
+	if (available) {
+		GLuint64 ns;
+		glGetQueryObjectui64v(done, GL_QUERY_RESULT, &ns);
+		light_gpu_time = ns * 1e-6;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, timer_query[timer_current]);
+	timer_issued[timer_current] = true;
+
+	// for the bounded passes, see light/all.h
+	const t_attachment* from = gbuf_fbo.depth.ptr;
+	glCopyImageSubData(
+		from->id, GL_TEXTURE_2D, 0, 0, 0, 0,
+		sspace_fbo_bounded.depth->id, GL_TEXTURE_2D, 0, 0, 0, 0,
+		from->width, from->height, 1);
+
+	sspace_fbo.apply();
 
 	glClearColor(light_ambience.x, light_ambience.y,
 			light_ambience.z, 1.0);
@@ -45,6 +84,21 @@ void compute_all_lighting ()
 	// go through all the kinds of lights
 	compute_lighting_cone();
 	compute_lighting_sun();
+
+	glEndQuery(GL_TIME_ELAPSED);
+	timer_current ^= 1;
+}
+
+void light_begin_pass ()
+{
+	frame_stats.light_passes++;
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+}
+
+void light_end_pass ()
+{
+	glDisable(GL_BLEND);
 }
 
 void light_init_material ()
@@ -56,11 +110,34 @@ void light_init_material ()
 
 void light_apply_material ()
 {
-	const t_fbo& sspace = sspace_fbo[current_sspace_fbo];
-	bind_tex2d_to_slot(0, sspace.color[LIGHT_SLOT_DIFFUSE]->id);
-	bind_tex2d_to_slot(1, sspace.color[LIGHT_SLOT_SPECULAR]->id);
+	bind_tex2d_to_slot(0, sspace_fbo.color[LIGHT_SLOT_DIFFUSE]->id);
+	bind_tex2d_to_slot(1, sspace_fbo.color[LIGHT_SLOT_SPECULAR]->id);
+}
+
+
+static std::vector<t_attachment*> shadow_maps;
+static bool shadow_pcf = true;
+
+void light_add_shadow_map (t_attachment* a)
+{
+	shadow_maps.push_back(a);
+	attachment_set_compare(a, shadow_pcf);
 }
 
+void light_remove_shadow_map (t_attachment* a)
+{
+	shadow_maps.erase(std::remove(shadow_maps.begin(),
+		shadow_maps.end(), a), shadow_maps.end());
+}
+
+COMMAND_ROUTINE (light_shadow_pcf)
+{
+	if (ev != PRESS || args.empty())
+		return;
+	shadow_pcf = atoi(args[0].c_str());
+	for (t_attachment* a: shadow_maps)
+		attachment_set_compare(a, shadow_pcf);
+}
 
 COMMAND_ROUTINE (light_ambience)
 {
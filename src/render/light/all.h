@@ -20,8 +20,32 @@ void light_init_material ();
 /* Called on each material application - binds the textures */
 void light_apply_material ();
 
-extern t_fbo sspace_fbo[2];
-extern int current_sspace_fbo;
+/*
+ * Shadow maps are depth textures sampled with comparison.
+ * The lights register theirs so that hardware PCF can be toggled
+ */
+void light_add_shadow_map (t_attachment* a);
+void light_remove_shadow_map (t_attachment* a);
+
+/*
+ * The light buffers: the ambience, with each light's share added on
+ *   top with GL_ONE, GL_ONE blending, between light_begin_pass() and
+ *   light_end_pass()
+ */
+extern t_fbo sspace_fbo;
+void light_begin_pass ();
+void light_end_pass ();
+
+/*
+ * The same buffers along with a copy of the G-buffer's depth and
+ *   stencil, made as the lighting begins, for passes limited to where
+ *   a light can reach (see light/cone.cpp); a copy, as those passes
+ *   sample the G-buffer's own
+ */
+extern t_fbo sspace_fbo_bounded;
+
+/* GPU time of the latest lighting that has finished, in ms */
+extern float light_gpu_time;
 
 extern vec3 light_ambience;
 
@@ -31,22 +55,13 @@ extern vec3 light_ambience;
  */
 namespace uniform_loc_light
 {
-	/*
-	 * For doing the "ping-pong" accumulation, sampling
-	 * the previous buffer while writing to the new one.
-	 * TODO: image load/store may be more efficient?
-	 */
-	constexpr int prev_diffuse_map = 0;
-	constexpr int prev_specular_map = 1;
-
 	/*
 	 * The sampler for light mapping.
 	 * Each light type implements its own, actually
 	 */
 	constexpr int depth_map = 2;
 
-	/* For specular highlights */
-	constexpr int eye_position = 3;
+	/* The eye position comes from the frame uniform block */
 }
 
 /*
@@ -3,9 +3,13 @@
 #include "render/material.h"
 #include "render/resource.h"
 #include "render/gbuffer.h"
+#include "render/settings.h"
 #include "render/ctx.h"
 #include "core/core.h"
+#include "input/cmds.h"
 #include "misc.h"
+#include <algorithm>
+#include <cmath>
 
 std::vector<e_light_cone*> lights_cone;
 
@@ -13,40 +17,344 @@ std::vector<e_light_cone*> lights_cone;
 static vec3 unif_pos;
 static vec3 unif_rgb;
 static mat4 unif_view;
-static vec2 unif_bounds[2];
+static int unif_layer;
+
+/*
+ * The shadow atlas: each light gets a slot of its own, which only
+ *   gets rerendered when something in it moves, and lights without
+ *   a slot take the least recently used one.
+ * The extra last layer (cone_atlas_slots) is scratch space for
+ *   compositing the moving casters over a static map
+ */
+static t_attachment* atlas = nullptr;
+static t_fbo atlas_fbo[MAX_CONE_ATLAS_SLOTS + 1];
+
+static e_light_cone* slot_owner[MAX_CONE_ATLAS_SLOTS];
+static unsigned long long slot_last_used[MAX_CONE_ATLAS_SLOTS];
+
+/*
+ * With the static/dynamic split, casters that have recently moved
+ *   are kept out of the cached maps and drawn over them every frame,
+ *   so that a moving prop does not invalidate a light each tick
+ */
+static bool static_split = false;
+
+/* The cached maps were rendered with or without the moving casters */
+COMMAND_ROUTINE (light_cone_split)
+{
+	static_split = (ev == PRESS);
+	for (e_light_cone* l: lights_cone) {
+		l->shadow_valid = false;
+		l->shadow_dynamic.clear();
+	}
+}
+constexpr unsigned long long dynamic_ticks = 60;
+
+/*
+ * Clustered shading: the screen is split into tiles, and those by
+ *   depth into slices, making clusters. Each light is listed in the
+ *   clusters its cone reaches, and then all of the lights are summed
+ *   up in one screenspace pass, each pixel only going through those
+ *   listed in its cluster.
+ * All the maps of a batch have to be in the atlas at once, so a light
+ *   that would take the slot of one already batched (or the scratch
+ *   layer) has the batch drawn first. With enough slots, that is one
+ *   pass for all of the lights.
+ * The unclustered way, one pass per light, is kept for comparison
+ */
+static bool unclustered = false;
+COMMAND_SET_BOOL (light_cone_unclustered, unclustered);
+
+constexpr int cluster_x = 16;
+constexpr int cluster_y = 9;
+constexpr int cluster_z = 24;
+constexpr int num_clusters = cluster_x * cluster_y * cluster_z;
+
+/* Has to match t_cone_light in internal/light/cone_clustered.frag */
+struct t_cone_light_data
+{
+	mat4 view;
+	vec4 pos;
+	vec4 rgb_layer;
+};
+
+/*
+ * The part of the screen which a light's cone (its view frustum)
+ *   reaches: a rect in [0, 1], and the distances in front of the camera
+ */
+struct t_screen_bounds
+{
+	vec2 lo, hi;
+	float z_lo, z_hi;
+};
 
-constexpr int cone_lspace_resolution = 1024;
-static t_fbo lspace_fbo;
+/* The clusters which a light reaches, ends inclusive */
+struct t_cluster_range
+{
+	ivec3 start;
+	ivec3 end;
+};
+
+static std::vector<t_cone_light_data> batch;
+static std::vector<t_cluster_range> batch_ranges;
+static t_screen_bounds batch_bounds;
+static bool slot_batched[MAX_CONE_ATLAS_SLOTS + 1];
+
+/* Offset and count for each cluster, and the list they point into */
+static std::vector<uint32_t> cluster_grid;
+static std::vector<uint32_t> cluster_lights;
+
+static GLuint lights_ubo;
+static GLuint grid_buffer, grid_tex;
+static GLuint list_buffer, list_tex;
 
 static GLuint program;
+static GLuint program_clustered;
+static GLuint volume_program;
 
-void init_lighting_cone ()
+static void set_common_uniforms ()
 {
+	glUniform1i(uniform_loc_light_cone::depth_map, 2);
+
+	gbuffer_set_samplers();
+}
+
+void realloc_lighting_cone ()
+{
+	if (atlas != nullptr) {
+		light_remove_shadow_map(atlas);
+		attachment_free(atlas);
+		for (t_fbo& fbo: atlas_fbo)
+			fbo.destroy();
+
+		// the lights have to be given their slots anew
+		for (e_light_cone* l: lights_cone)
+			light_cone_release_slot(l);
+
+		glDeleteProgram(program);
+		glDeleteProgram(program_clustered);
+	}
+
 	int s = cone_lspace_resolution;
-	lspace_fbo.make()
-		.attach_color(make_tex2d(s, s, GL_R32F))
-		.attach_depth(make_rbo(s, s, GL_DEPTH_COMPONENT))
-		.assert_complete();
+	int d = cone_atlas_slots + 1;
+	atlas = make_tex2d_array(s, s, d, GL_DEPTH_COMPONENT24);
+	light_add_shadow_map(atlas);
+
+	for (int i = 0; i < d; i++) {
+		atlas_fbo[i].make()
+			.attach_depth(atlas, i)
+			.set_mrt_slots({ GL_NONE })
+			.assert_complete();
+	}
 
 	program = make_glsl_program(
 		{ get_vert_shader("internal/gbuffer_quad"),
 		  get_frag_shader("internal/light/cone") });
 	glUseProgram(program);
+	set_common_uniforms();
 
-	glUniform1i(uniform_loc_light::prev_diffuse_map, 0);
-	glUniform1i(uniform_loc_light::prev_specular_map, 1);
+	// the light block has room for CONE_ATLAS_SLOTS lights
+	program_clustered = make_glsl_program(
+		{ get_vert_shader("internal/gbuffer_quad"),
+		  get_frag_shader("internal/light/cone_clustered") });
+	glUseProgram(program_clustered);
+	set_common_uniforms();
+
+	namespace loc = uniform_loc_light_cone;
+	glUniform1i(loc::cluster_grid, 7);
+	glUniform1i(loc::cluster_lights, 8);
+	glUniform3i(loc::cluster_dims, cluster_x, cluster_y, cluster_z);
+}
 
-	glUniform1i(uniform_loc_light_cone::depth_map, 2);
+void init_lighting_cone ()
+{
+	realloc_lighting_cone();
+
+	glCreateBuffers(1, &lights_ubo);
+	glCreateBuffers(1, &grid_buffer);
+	glCreateBuffers(1, &list_buffer);
+
+	glCreateTextures(GL_TEXTURE_BUFFER, 1, &grid_tex);
+	glCreateTextures(GL_TEXTURE_BUFFER, 1, &list_tex);
+
+	cluster_grid.resize(2 * num_clusters);
+
+	volume_program = make_glsl_program(
+		{ get_vert_shader("internal/light/volume"),
+		  get_frag_shader("common/null") });
+}
+
+static bool is_dynamic (const e_base* e)
+{
+	return e->has_moved && e->moved_tick + dynamic_ticks > tick;
+}
+
+static bool is_static (const e_base* e)
+{
+	return !is_dynamic(e);
+}
+
+static bool light_sees (const e_light_cone* l, const t_bound_box& b)
+{
+	return l->vis.may_see(b);
+}
+
+void light_cone_entity_moved (const e_base* e,
+		const t_bound_box& before, const t_bound_box& after)
+{
+	for (e_light_cone* l: lights_cone) {
+		if (!l->shadow_valid || l == e)
+			continue;
+
+		// already left out of the cached map
+		if (static_split && is_dynamic(e))
+			continue;
+
+		if (light_sees(l, before) || light_sees(l, after))
+			l->shadow_valid = false;
+	}
+}
+
+void light_cone_refill_vis ()
+{
+	restorer rest(render_ctx);
+
+	for (e_light_cone* l: lights_cone) {
+		l->fill_vis();
+		l->shadow_valid = false;
+	}
+}
+
+void light_cone_release_slot (e_light_cone* l)
+{
+	if (l->shadow_slot >= 0)
+		slot_owner[l->shadow_slot] = nullptr;
+	l->shadow_slot = -1;
+	l->shadow_valid = false;
+}
+
+static int least_recent_slot ()
+{
+	int slot = 0;
+	for (int i = 1; i < cone_atlas_slots; i++) {
+		if (slot_last_used[i] < slot_last_used[slot])
+			slot = i;
+	}
+	return slot;
+}
+
+static int acquire_slot (e_light_cone* l)
+{
+	if (l->shadow_slot < 0) {
+		int slot = least_recent_slot();
+		if (slot_owner[slot] != nullptr)
+			light_cone_release_slot(slot_owner[slot]);
+
+		slot_owner[slot] = l;
+		l->shadow_slot = slot;
+		l->shadow_valid = false;
+	}
+
+	// count from 1 so that a never used slot is always the oldest
+	slot_last_used[l->shadow_slot] = tick + 1;
+	return l->shadow_slot;
+}
+
+/*
+ * The depth bias, in window space, pushing the casters back by their
+ *   slope and then by so many of the smallest steps of the depth
+ */
+constexpr float depth_bias_slope = 1.5;
+constexpr float depth_bias_units = 4.0;
+
+static void begin_depth_render ()
+{
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(depth_bias_slope, depth_bias_units);
+	material_barrier();
+}
 
-	using namespace uniform_loc_gbuffer;
-	glUniform1i(world_pos, 3);
-	glUniform1i(world_norm, 4);
-	glUniform1i(specular, 5);
-	glUniform1i(screen_depth, 6);
+static void end_depth_render ()
+{
+	glDisable(GL_POLYGON_OFFSET_FILL);
 }
 
+/* Render whatever is not left out of the cached map */
+static void render_cached_map (e_light_cone* l)
+{
+	restorer rest(render_ctx);
+	l->view();
+
+	atlas_fbo[l->shadow_slot].apply();
+	begin_depth_render();
+
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	l->vis.take_occ_readback();
+	l->vis.entity_filter = static_split ? is_static : nullptr;
+	l->vis.render();
+	l->vis.entity_filter = nullptr;
+	end_depth_render();
+
+	l->shadow_valid = true;
+}
+
+/*
+ * Those left out of the cached map which the light sees now, gathered
+ *   every frame, as they may have only just come into its view
+ */
+static void gather_dynamic_casters (e_light_cone* l)
+{
+	l->shadow_dynamic.clear();
+	if (vis_gpu_driven) {
+		static std::vector<e_base*> entities;
+		entities.clear();
+		l->vis.entities_in_view(entities);
+		for (e_base* e: entities) {
+			if (is_dynamic(e) && l->vis.entity_contributes(e))
+				l->shadow_dynamic.push_back(e);
+		}
+		return;
+	}
+
+	for (const oct_node* n: l->vis.leaves) {
+		for (e_base* e: n->entities_inside) {
+			if (is_dynamic(e) && l->vis.entity_contributes(e))
+				l->shadow_dynamic.push_back(e);
+		}
+	}
+	std::sort(l->shadow_dynamic.begin(), l->shadow_dynamic.end());
+	l->shadow_dynamic.erase(std::unique(l->shadow_dynamic.begin(),
+		l->shadow_dynamic.end()), l->shadow_dynamic.end());
+}
+
+/* Draw the moving casters over a copy of the cached map */
+static void render_dynamic_casters (const e_light_cone* l)
+{
+	int s = cone_lspace_resolution;
+	glCopyImageSubData(
+		atlas->id, GL_TEXTURE_2D_ARRAY, 0, 0, 0, l->shadow_slot,
+		atlas->id, GL_TEXTURE_2D_ARRAY, 0, 0, 0, cone_atlas_slots,
+		s, s, 1);
+
+	restorer rest(render_ctx);
+	l->view();
+
+	atlas_fbo[cone_atlas_slots].apply();
+	begin_depth_render();
+
+	for (const e_base* e: l->shadow_dynamic)
+		e->render();
+	end_depth_render();
+}
+
+static void clustered_pass ();
+
 /* Returns: whether this light is potentially visible */
-static bool fill_depth_map (const e_light_cone* l)
+static bool fill_depth_map (e_light_cone* l)
 {
 	static constexpr t_bound_box view_bounds =
 		{ { -1.0, -1.0, 0.0 }, { 1.0, 1.0, 1.0 } };
@@ -83,65 +391,336 @@ static bool fill_depth_map (const e_light_cone* l)
 		return false;
 	}
 
-	// make sure to draw everything between light and slice, too
-	lbounds.start.z = 0.0;
-
+	// the whole of the light's view gets rendered, even the parts
+	// we cannot see right now, so that the map can be reused
 	unif_view = proj * view;
 	unif_pos = l->pos;
 	unif_rgb = l->rgb;
-	unif_bounds[0] = lbounds.start;
-	unif_bounds[1] = lbounds.end;
 
-	// do the rendering at the intersection
-	// of what light sees and what we see
-	vec3 center = vec3(-0.5, -0.5, 0.0) * (lbounds.start + lbounds.end);
-	vec3 scale = vec3(2.0, 2.0, 1.0) / (lbounds.end - lbounds.start);
-	mat4 subfrustum = glm::translate(glm::scale(mat4(1.0), scale), center);
-	render_ctx.proj = subfrustum * render_ctx.proj;
+	// would take away the map of a light in the batch
+	if (l->shadow_slot < 0 && slot_batched[least_recent_slot()])
+		clustered_pass();
 
-	lspace_fbo.apply();
-	glDepthMask(GL_TRUE);
-	glDepthFunc(GL_LESS);
-	glEnable(GL_DEPTH_TEST);
+	unif_layer = acquire_slot(l);
 
-	glClearColor(0.0, 0.0, 0.0, 1.0);
-	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+	if (static_split) {
+		// casters that have settled belong in the cached map
+		for (const e_base* e: l->shadow_dynamic) {
+			if (is_static(e))
+				l->shadow_valid = false;
+		}
+		gather_dynamic_casters(l);
+	}
 
-	material_barrier();
-	l->vis.render();
+	if (!l->shadow_valid)
+		render_cached_map(l);
+
+	if (static_split && !l->shadow_dynamic.empty()) {
+		if (slot_batched[cone_atlas_slots])
+			clustered_pass();
+
+		render_dynamic_casters(l);
+		unif_layer = cone_atlas_slots;
+	}
 
 	return true;
 }
 
-static void lighting_pass ()
+/* Returns: whether the light reaches anywhere on the screen */
+static bool light_screen_bounds (const mat4& light_viewproj,
+		t_screen_bounds& b)
 {
-	current_sspace_fbo ^= 1;
-	sspace_fbo[current_sspace_fbo].apply();
+	mat4 to_world = glm::inverse(light_viewproj);
+	mat4 to_camera = camera.get_proj() * camera.get_view();
 
-	glUseProgram(program);
+	b = { vec2(1.0), vec2(0.0), INFINITY, 0.0 };
+	bool crosses_eye = false;
+
+	for (int i = 0; i < 8; i++) {
+		vec4 corner((i & 1) ? 1.0 : -1.0,
+		            (i & 2) ? 1.0 : -1.0,
+		            (i & 4) ? 1.0 : -1.0, 1.0);
+		corner = to_world * corner;
+		vec4 c = to_camera * (corner / corner.w);
+
+		// w is the depth in front of the camera
+		b.z_lo = std::min(b.z_lo, c.w);
+		b.z_hi = std::max(b.z_hi, c.w);
+
+		if (c.w < camera.z_near) {
+			crosses_eye = true;
+			continue;
+		}
+		vec2 uv = vec2(c) / c.w * 0.5f + 0.5f;
+		b.lo = glm::min(b.lo, uv);
+		b.hi = glm::max(b.hi, uv);
+	}
+
+	// the projected corners say nothing then
+	if (crosses_eye) {
+		b.lo = vec2(0.0);
+		b.hi = vec2(1.0);
+	}
+
+	b.z_lo = std::max(b.z_lo, camera.z_near);
+	b.z_hi = std::min(b.z_hi, camera.z_far);
+	b.lo = glm::max(b.lo, vec2(0.0));
+	b.hi = glm::min(b.hi, vec2(1.0));
+
+	return b.z_lo <= b.z_hi && b.lo.x <= b.hi.x && b.lo.y <= b.hi.y;
+}
+
+/*
+ * The lighting passes only run where the light can reach: within its
+ *   scissor rect, on pixels with depth in its range (if the depth
+ *   bounds test is there), and optionally only on those marked in the
+ *   stencil as being inside the light's volume
+ */
+static bool stencil_volumes = false;
+static bool volume_marked = false;
+COMMAND_ROUTINE (light_cone_stencil)
+{
+	if (ev != PRESS || args.empty())
+		return;
+	stencil_volumes = atoi(args[0].c_str());
+}
 
-	const t_fbo& other_fbo = sspace_fbo[current_sspace_fbo ^ 1];
-	bind_tex2d_to_slot(0, other_fbo.color[LIGHT_SLOT_DIFFUSE]->id);
-	bind_tex2d_to_slot(1, other_fbo.color[LIGHT_SLOT_SPECULAR]->id);
+/* What the depth buffer has at a distance in front of the camera */
+static float window_depth (float z)
+{
+	vec4 c = camera.get_proj() * vec4(0.0, 0.0, -z, 1.0);
+	return glm::clamp(c.z / c.w * 0.5f + 0.5f, 0.0f, 1.0f);
+}
 
-	bind_tex2d_to_slot(2, lspace_fbo.color[0]->id);
+static void begin_bounded_pass (const t_screen_bounds& b)
+{
+	t_fbo& fbo = sspace_fbo_bounded;
+	fbo.apply();
+	light_begin_pass();
+
+	glDisable(GL_DEPTH_TEST);
+	glDepthMask(GL_FALSE);
+
+	vec2 size(fbo.width, fbo.height);
+	ivec2 lo = glm::floor(b.lo * size);
+	ivec2 hi = glm::ceil(b.hi * size);
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(lo.x, lo.y, hi.x - lo.x, hi.y - lo.y);
+
+	if (GLEW_EXT_depth_bounds_test) {
+		glEnable(GL_DEPTH_BOUNDS_TEST_EXT);
+		glDepthBoundsEXT(window_depth(b.z_lo), window_depth(b.z_hi));
+	}
 
-	bind_tex2d_to_slot(3, gbuf_fbo.color[GBUF_SLOT_WORLD_POS]->id);
-	bind_tex2d_to_slot(4, gbuf_fbo.color[GBUF_SLOT_WORLD_NORM]->id);
-	bind_tex2d_to_slot(5, gbuf_fbo.color[GBUF_SLOT_SPECULAR]->id);
-	bind_tex2d_to_slot(6, gbuf_fbo.depth->id);
+	bind_to_slot(2, GL_TEXTURE_2D_ARRAY, atlas->id);
+
+	gbuffer_bind_textures();
+	glStencilMask(0);
+}
+
+static void end_bounded_pass ()
+{
+	glStencilMask(0xff);
+
+	// clear the marks of mark_light_volume()
+	if (volume_marked) {
+		glClear(GL_STENCIL_BUFFER_BIT);
+		glDisable(GL_STENCIL_TEST);
+		volume_marked = false;
+	}
+
+	light_end_pass();
+	glDisable(GL_SCISSOR_TEST);
+	if (GLEW_EXT_depth_bounds_test)
+		glDisable(GL_DEPTH_BOUNDS_TEST_EXT);
+
+	glEnable(GL_DEPTH_TEST);
+	glDepthMask(GL_TRUE);
+}
+
+/*
+ * Mark the pixels whose surface is inside the light's volume, by
+ *   counting the volume's faces behind it (which also works with the
+ *   camera inside). The marks are cleared after the pass, within
+ *   the same scissor rect
+ */
+static void mark_light_volume ()
+{
+	volume_marked = true;
+
+	glUseProgram(volume_program);
+	glUniformMatrix4fv(0, 1, false,
+		glm::value_ptr(glm::inverse(unif_view)));
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	// so that the far side never gets clipped away
+	glEnable(GL_DEPTH_CLAMP);
+	glDisable(GL_CULL_FACE);
+
+	glEnable(GL_STENCIL_TEST);
+	glStencilMask(0xff);
+	glStencilFunc(GL_ALWAYS, 0, 0xff);
+	glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+	glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+	cuboid_outwards.draw();
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_CLAMP);
+	glEnable(GL_CULL_FACE);
+
+	glStencilMask(0);
+	glStencilFunc(GL_NOTEQUAL, 0, 0xff);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+}
+
+static void lighting_pass ()
+{
+	t_screen_bounds b;
+	if (!light_screen_bounds(unif_view, b))
+		return;
+
+	begin_bounded_pass(b);
+	if (stencil_volumes)
+		mark_light_volume();
+
+	glUseProgram(program);
 
 	using glm::value_ptr;
 	using namespace uniform_loc_light_cone;
 	glUniform3fv(light_pos, 1, value_ptr(unif_pos));
 	glUniform3fv(light_rgb, 1, value_ptr(unif_rgb));
 	glUniformMatrix4fv(light_view, 1, false, value_ptr(unif_view));
-	glUniform2fv(light_bounds, 2, value_ptr(unif_bounds[0]));
+	glUniform1i(shadow_layer, unif_layer);
 
-	glUniform3fv(uniform_loc_light::eye_position,
-			1, value_ptr(camera.pos));
+	gbuffer_pass();
+	end_bounded_pass();
+}
+
+/* The clusters within the bounds */
+static t_cluster_range bounds_clusters (const t_screen_bounds& b)
+{
+	auto slice = [] (float z) {
+		return (int) (std::log(z / camera.z_near)
+			/ std::log(camera.z_far / camera.z_near) * cluster_z);
+	};
+
+	ivec3 dims(cluster_x, cluster_y, cluster_z);
+	t_cluster_range r;
+	r.start = ivec3(b.lo.x * cluster_x, b.lo.y * cluster_y,
+			slice(b.z_lo));
+	r.end = ivec3(b.hi.x * cluster_x, b.hi.y * cluster_y,
+			slice(b.z_hi));
+	r.start = glm::clamp(r.start, ivec3(0), dims - 1);
+	r.end = glm::clamp(r.end, ivec3(0), dims - 1);
+	return r;
+}
+
+static void add_to_batch ()
+{
+	t_screen_bounds b;
+	if (!light_screen_bounds(unif_view, b))
+		return;
+
+	if (batch.empty()) {
+		batch_bounds = b;
+	} else {
+		batch_bounds.lo = glm::min(batch_bounds.lo, b.lo);
+		batch_bounds.hi = glm::max(batch_bounds.hi, b.hi);
+		batch_bounds.z_lo = std::min(batch_bounds.z_lo, b.z_lo);
+		batch_bounds.z_hi = std::max(batch_bounds.z_hi, b.z_hi);
+	}
+
+	batch.push_back({ unif_view, vec4(unif_pos, 1.0),
+		vec4(unif_rgb, unif_layer) });
+	batch_ranges.push_back(bounds_clusters(b));
+	slot_batched[unif_layer] = true;
+}
+
+static void fill_clusters ()
+{
+	std::fill(cluster_grid.begin(), cluster_grid.end(), 0);
+
+	auto cluster = [] (int x, int y, int z) {
+		return (z * cluster_y + y) * cluster_x + x;
+	};
+	auto for_each_cluster = [&] (const t_cluster_range& r, auto f) {
+		for (int z = r.start.z; z <= r.end.z; z++)
+		for (int y = r.start.y; y <= r.end.y; y++)
+		for (int x = r.start.x; x <= r.end.x; x++)
+			f(cluster(x, y, z));
+	};
+
+	// count, then make the counts into offsets, then fill in the list
+	for (const t_cluster_range& r: batch_ranges) {
+		for_each_cluster(r, [] (int c) {
+			cluster_grid[2 * c + 1]++;
+		});
+	}
+
+	uint32_t offset = 0;
+	for (int c = 0; c < num_clusters; c++) {
+		cluster_grid[2 * c] = offset;
+		offset += cluster_grid[2 * c + 1];
+		cluster_grid[2 * c + 1] = 0;
+	}
+
+	cluster_lights.resize(offset);
+	for (size_t i = 0; i < batch_ranges.size(); i++) {
+		for_each_cluster(batch_ranges[i], [i] (int c) {
+			uint32_t& n = cluster_grid[2 * c + 1];
+			cluster_lights[cluster_grid[2 * c] + n++] = i;
+		});
+	}
+}
+
+static void clustered_pass ()
+{
+	if (batch.empty())
+		return;
+
+	fill_clusters();
+
+	// the block is always read in whole
+	glNamedBufferData(lights_ubo,
+		sizeof(t_cone_light_data) * cone_atlas_slots,
+		nullptr, GL_STREAM_DRAW);
+	glNamedBufferSubData(lights_ubo, 0,
+		sizeof(t_cone_light_data) * batch.size(), batch.data());
+	glBindBufferBase(GL_UNIFORM_BUFFER, UBO_BINDING_CONE_LIGHTS,
+			lights_ubo);
+
+	glNamedBufferData(grid_buffer,
+		sizeof(uint32_t) * cluster_grid.size(),
+		cluster_grid.data(), GL_STREAM_DRAW);
+	glTextureBuffer(grid_tex, GL_RG32UI, grid_buffer);
+
+	// an empty buffer cannot back a texture
+	cluster_lights.push_back(0);
+	glNamedBufferData(list_buffer,
+		sizeof(uint32_t) * cluster_lights.size(),
+		cluster_lights.data(), GL_STREAM_DRAW);
+	glTextureBuffer(list_tex, GL_R32UI, list_buffer);
+
+	// the volumes of a whole batch are not worth marking
+	begin_bounded_pass(batch_bounds);
+
+	glUseProgram(program_clustered);
+
+	bind_to_slot(7, GL_TEXTURE_BUFFER, grid_tex);
+	bind_to_slot(8, GL_TEXTURE_BUFFER, list_tex);
+
+	glUniform2f(uniform_loc_light_cone::cluster_depth, camera.z_near,
+			std::log(camera.z_far / camera.z_near));
 
 	gbuffer_pass();
+	end_bounded_pass();
+
+	batch.clear();
+	batch_ranges.clear();
+	std::fill(std::begin(slot_batched), std::end(slot_batched), false);
 }
 
 void compute_lighting_cone ()
@@ -149,7 +728,14 @@ void compute_lighting_cone ()
 	render_ctx.stage = RENDER_STAGE_LIGHTING_LSPACE;
 
 	for (e_light_cone* l: lights_cone) {
-		if (fill_depth_map(l))
+		if (!fill_depth_map(l))
+			continue;
+
+		if (unclustered)
 			lighting_pass();
+		else
+			add_to_batch();
 	}
+
+	clustered_pass();
 }
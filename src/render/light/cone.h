@@ -6,10 +6,33 @@
 #include <vector>
 
 void init_lighting_cone ();
+
+/* Remake the shadow atlas for the current settings */
+void realloc_lighting_cone ();
 void compute_lighting_cone ();
 
 extern std::vector<e_light_cone*> lights_cone;
 
+/*
+ * The shadow atlas has a slot per light drawn at once; the clustered
+ *   pass has the lights in a uniform block, which must fit in 16 KiB
+ */
+constexpr int MAX_CONE_ATLAS_SLOTS = 128;
+
+/*
+ * Keep the cached shadow maps up to date: invalidate those of
+ *   the lights which see either of the entity's boxes
+ */
+void light_cone_entity_moved (const e_base* e,
+		const t_bound_box& before, const t_bound_box& after);
+void light_cone_release_slot (e_light_cone* l);
+
+/*
+ * Fill the lights' visible sets again, e.g. for a new map or
+ *   after vis_gpu changed
+ */
+void light_cone_refill_vis ();
+
 /*
  * GLSL uniform locations for calculating light
  * when rendering actual geometry from a light's perspective
@@ -21,7 +44,13 @@ namespace uniform_loc_light_cone
 	constexpr int light_pos = 6;
 	constexpr int light_rgb = 9;
 	constexpr int light_view = 12;
-	constexpr int light_bounds = 100;
+	constexpr int shadow_layer = 13;
+
+	/* Clustered pass */
+	constexpr int cluster_dims = 14;
+	constexpr int cluster_depth = 15;
+	constexpr int cluster_grid = 16;
+	constexpr int cluster_lights = 17;
 }
 
 #endif // LIGHT_CONE_H
@@ -6,6 +6,7 @@
 #include "render/render.h"
 #include "render/vis.h"
 #include "render/gbuffer.h"
+#include "render/settings.h"
 #include "input/cmds.h"
 #include <array>
 #include <vector>
@@ -18,48 +19,143 @@
 
 std::vector<e_light_sun*> lights_sun;
 
-constexpr int sun_num_cascades = 3;
-std::array<float, sun_num_cascades + 1> cascade_depths;
+/* There are sun_num_cascades (see render/settings.h) of these in use */
+std::array<float, MAX_RENDER_LAYERS + 1> cascade_depths;
 
-static GLuint program;
+static GLuint program = 0;
 
-constexpr int sun_lspace_resolution = 2048;
+/*
+ * Cascades can be rendered either one by one, or all
+ * at once using layered rendering - the default
+ */
+static t_attachment* depth_maps = nullptr;
+t_fbo sun_cascade_fbo[MAX_RENDER_LAYERS];
+t_fbo sun_layered_fbo;
 
-t_fbo sun_lspace_fbo;
+static bool multipass = false;
+COMMAND_SET_BOOL (light_sun_multipass, multipass);
 
-void init_lighting_sun ()
+/*
+ * The nearest cascade is rerendered every frame, and the farther ones
+ *   every update_interval frames, each in its own phase. A cascade is
+ *   rerendered sooner if the one it was last rendered with no longer
+ *   covers it, or if the light itself has changed
+ */
+static int update_interval = 1;
+
+/* What each cascade was last rendered with */
+static struct {
+	const e_light_sun* light = nullptr;
+	vec3 ang;
+	float distance;
+	t_bound_box casters;
+	unsigned long long frame;
+} cascade_state[MAX_RENDER_LAYERS];
+static unsigned long long frame = 0;
+
+/* Halfway between the uniform and the logarithmic split */
+static void spread_cascades ()
+{
+	float n = camera.z_near;
+	float f = camera.z_far;
+
+	for (int i = 1; i < sun_num_cascades; i++) {
+		float t = (float) i / sun_num_cascades;
+		cascade_depths[i] = 0.5 * (n + (f - n) * t)
+		                  + 0.5 * n * std::pow(f / n, t);
+	}
+}
+
+void realloc_lighting_sun ()
 {
+	static int num_allocated = 0;
+
+	if (depth_maps != nullptr) {
+		light_remove_shadow_map(depth_maps);
+		attachment_free(depth_maps);
+		for (t_fbo& fbo: sun_cascade_fbo)
+			fbo.destroy();
+		sun_layered_fbo.destroy();
+		glDeleteProgram(program);
+	}
+
+	// the depths set with light_cascades are for another count
+	if (num_allocated != 0 && num_allocated != sun_num_cascades)
+		spread_cascades();
+	num_allocated = sun_num_cascades;
+
+	// whatever the maps were rendered with is gone
+	for (auto& st: cascade_state)
+		st.light = nullptr;
+
 	int s = sun_lspace_resolution;
-	sun_lspace_fbo.make().attach_depth(make_rbo(s, s, GL_DEPTH_COMPONENT));
-	t_attachment* dm = make_tex2d_array(s, s, sun_num_cascades, GL_R32F);
-	for (int i = 0; i < sun_num_cascades; i++)
-		sun_lspace_fbo.attach_color(dm, i, i);
+	depth_maps = make_tex2d_array(s, s, sun_num_cascades,
+			GL_DEPTH_COMPONENT24);
+	light_add_shadow_map(depth_maps);
+
+	for (int i = 0; i < sun_num_cascades; i++) {
+		sun_cascade_fbo[i].make()
+			.attach_depth(depth_maps, i)
+			.set_mrt_slots({ GL_NONE })
+			.assert_complete();
+	}
+
+	sun_layered_fbo.make()
+		.attach_depth(depth_maps, ALL_SLICES)
+		.set_mrt_slots({ GL_NONE })
+		.assert_complete();
 
+	// the shader gets compiled for the current SUN_NUM_CASCADES
 	program = make_glsl_program(
 		{ get_vert_shader("internal/gbuffer_quad"),
 		  get_frag_shader("internal/light/sun") });
 	glUseProgram(program);
 
-	glUniform1i(uniform_loc_light::prev_diffuse_map, 0);
-	glUniform1i(uniform_loc_light::prev_specular_map, 1);
 	glUniform1i(uniform_loc_light_sun::depth_map, 2);
 
-	glUniform1i(uniform_loc_gbuffer::world_pos, 3);
-	glUniform1i(uniform_loc_gbuffer::world_norm, 4);
-	glUniform1i(uniform_loc_gbuffer::specular, 5);
-	glUniform1i(uniform_loc_gbuffer::screen_depth, 6);
+	gbuffer_set_samplers();
 }
 
+void init_lighting_sun ()
+{
+	realloc_lighting_sun();
+}
+
+
+/* The shadow casters of each cascade, and of all of them at once */
+static t_visible_set cascade_vis[MAX_RENDER_LAYERS];
+static t_visible_set layered_vis;
+
+void light_sun_refill_vis ()
+{
+	for (auto& st: cascade_state)
+		st.light = nullptr;
+}
+
+static bool cascade_due (int casc, const e_light_sun* l,
+		const t_bound_box& receivers)
+{
+	const auto& st = cascade_state[casc];
+
+	if (st.light != l || st.ang != l->ang || st.distance != l->distance)
+		return true;
+	if (!st.casters.point_in(receivers.start)
+	 || !st.casters.point_in(receivers.end))
+		return true;
+
+	return casc == 0 || update_interval <= 1
+	    || (frame + casc) % update_interval == 0;
+}
 
 static vec3 unif_rgb;
-static mat4 unif_view[sun_num_cascades];
+static mat4 unif_view[MAX_RENDER_LAYERS];
 static vec3 unif_direction;
-static float unif_depths[sun_num_cascades + 1];
+static float unif_depths[MAX_RENDER_LAYERS + 1];
 
 static void fill_depth_maps (const e_light_sun* l)
 {
 	mat3 rot = rotate_xyz(glm::radians(l->ang - vec3(90.0, 0.0, 0.0)));
-	vec3 planes[4 * (sun_num_cascades + 1)];
+	vec3 planes[4 * (MAX_RENDER_LAYERS + 1)];
 
 	for (int i = 0; i < sun_num_cascades + 1; i++) {
 		camera.get_corner_points(cascade_depths[i], planes + 4*i);
@@ -77,16 +173,15 @@ static void fill_depth_maps (const e_light_sun* l)
 			planes[4*i + j] = rot * planes[4*i + j];
 	}
 
-	sun_lspace_fbo.apply();
-	glClearColor(0.0, 0.0, 0.0, 1.0);
-
 	material_barrier();
 
 	restorer rest(render_ctx);
 	render_ctx.view = rot;
 	render_ctx.model = mat4(1.0);
 
-	for (unsigned int casc = 0; casc < sun_num_cascades; casc++) {
+	std::vector<const t_visible_set*> layer_sets(sun_num_cascades);
+
+	for (int casc = 0; casc < sun_num_cascades; casc++) {
 		t_bound_box lbound = { vec3(INFINITY), vec3(-INFINITY) };
 		for (int j = 0; j < 8; j++)
 			lbound.expand(planes[4*casc + j]);
@@ -105,12 +200,48 @@ static void fill_depth_maps (const e_light_sun* l)
 			lbound.start.x, lbound.end.x,
 			lbound.start.y, lbound.end.y,
 			-lbound.start.z - l->distance, -lbound.start.z);
+
+		// only what is inside the cascade, or between it and
+		// the sun, can cast shadows onto it
+		t_cull_box casters = { render_ctx.view, lbound };
+		casters.box.end.z = lbound.start.z + l->distance;
+
+		if (!cascade_due(casc, l, lbound)) {
+			// the shader keeps using what the map was rendered with
+			layer_sets[casc] = nullptr;
+			continue;
+		}
+
 		unif_view[casc] = render_ctx.proj * render_ctx.view;
+		cascade_state[casc] = { l, l->ang, l->distance,
+		                        casters.box, frame };
+		// towards the sun, for the clusters facing away from it
+		cascade_vis[casc].fill_cull_box(casters,
+			vec4(glm::transpose(rot) * vec3(0.0, 0.0, 1.0), 0.0));
+		cascade_vis[casc].set_contribution(
+			render_ctx.proj[1][1] * sun_lspace_resolution * 0.5f,
+			true, camera.pos);
+
+		sun_cascade_fbo[casc].apply();
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		if (!multipass) {
+			render_ctx.layer_viewproj[casc] = unif_view[casc];
+			layer_sets[casc] = &cascade_vis[casc];
+			continue;
+		}
+
+		cascade_vis[casc].render();
+	}
 
-		sun_lspace_fbo.set_mrt_slots({ GL_COLOR_ATTACHMENT0 + casc });
-		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+	if (!multipass) {
+		layered_vis.fill_layered(layer_sets);
 
-		all_leaves.render();
+		sun_layered_fbo.apply();
+
+		render_ctx.layered = true;
+		render_ctx.num_layers = sun_num_cascades;
+		layered_vis.render();
 	}
 
 	unif_rgb = l->rgb;
@@ -119,22 +250,15 @@ static void fill_depth_maps (const e_light_sun* l)
 
 static void lighting_pass ()
 {
-	current_sspace_fbo ^= 1;
-	sspace_fbo[current_sspace_fbo].apply();
+	sspace_fbo.apply();
+	light_begin_pass();
 
 	glUseProgram(program);
 
-	const t_fbo& other_fbo = sspace_fbo[current_sspace_fbo ^ 1];
-	bind_tex2d_to_slot(0, other_fbo.color[LIGHT_SLOT_DIFFUSE]->id);
-	bind_tex2d_to_slot(1, other_fbo.color[LIGHT_SLOT_SPECULAR]->id);
-
-	// color[0] really could have been any other index
-	bind_to_slot(2, GL_TEXTURE_2D_ARRAY, sun_lspace_fbo.color[0]->id);
+	// the layered framebuffer has the whole array attached
+	bind_to_slot(2, GL_TEXTURE_2D_ARRAY, sun_layered_fbo.depth->id);
 
-	bind_tex2d_to_slot(3, gbuf_fbo.color[GBUF_SLOT_WORLD_POS]->id);
-	bind_tex2d_to_slot(4, gbuf_fbo.color[GBUF_SLOT_WORLD_NORM]->id);
-	bind_tex2d_to_slot(5, gbuf_fbo.color[GBUF_SLOT_SPECULAR]->id);
-	bind_tex2d_to_slot(6, gbuf_fbo.depth->id);
+	gbuffer_bind_textures();
 
 	using glm::value_ptr;
 	using namespace uniform_loc_light_sun;
@@ -143,10 +267,9 @@ static void lighting_pass ()
 		value_ptr(unif_view[0]));
 	glUniform3fv(light_dir, 1, value_ptr(unif_direction));
 	glUniform1fv(view_depths, sun_num_cascades + 1, unif_depths);
-
-	glUniform3fv(uniform_loc_light::eye_position,
-			1, value_ptr(camera.pos));
 	gbuffer_pass();
+
+	light_end_pass();
 }
 
 void compute_lighting_sun ()
@@ -160,6 +283,34 @@ void compute_lighting_sun ()
 		fill_depth_maps(l);
 		lighting_pass();
 	}
+
+	frame++;
+}
+
+COMMAND_ROUTINE (light_sun_stats)
+{
+	if (ev != PRESS)
+		return;
+
+	for (int i = 0; i < sun_num_cascades; i++) {
+		const t_visible_set& v = cascade_vis[i];
+		std::cout << "cascade " << i
+			<< ": leaves " << v.leaves.size()
+			<< "/" << all_leaves.leaves.size()
+			<< ", entities " << v.num_entities_rendered
+			<< ", rendered " << frame - cascade_state[i].frame
+			<< " frames ago" << std::endl;
+	}
+}
+
+COMMAND_ROUTINE (light_sun_interval)
+{
+	if (ev != PRESS || args.empty())
+		return;
+
+	int n = atoi(args[0].c_str());
+	if (n >= 1)
+		update_interval = n;
 }
 
 COMMAND_ROUTINE (light_cascades)
@@ -6,8 +6,14 @@
 #include <vector>
 
 void init_lighting_sun ();
+
+/* Remake the depth maps and the program for the current settings */
+void realloc_lighting_sun ();
 void compute_lighting_sun ();
 
+/* Have every cascade filled and rendered anew, e.g. for a new map */
+void light_sun_refill_vis ();
+
 extern std::vector<e_light_sun*> lights_sun;
 
 namespace uniform_loc_light_sun
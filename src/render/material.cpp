@@ -5,8 +5,12 @@
 #include "render/resource.h"
 #include "render/light/all.h"
 #include "render/gbuffer.h"
+#include "render/ubo.h"
+#include "render/visbuf.h"
 #include <cassert>
 #include <algorithm>
+#include <map>
+#include <tuple>
 #include <sstream>
 
 t_material mat_none_instance;
@@ -22,6 +26,162 @@ void init_materials ()
 	cache_mat["OCCLUDE"] = mat_occlude;
 }
 
+/* Only these stages call into the user fragment shaders */
+static bool stage_uses_surface (t_render_stage stage)
+{
+	return stage == RENDER_STAGE_G_BUFFERS
+	    || stage == RENDER_STAGE_SHADE_FINAL
+	    || stage == RENDER_STAGE_VISBUF_RESOLVE;
+}
+
+static uint32_t variant_key (t_render_stage stage, uint32_t features)
+{
+	return stage | (features << 8);
+}
+
+static std::string program_defines (t_render_stage stage, uint32_t features)
+{
+	std::ostringstream s;
+	s << "#define STAGE " << stage << '\n';
+	if (features & MAT_FEATURE_LAYERED)
+		s << "#define LAYERED 1\n";
+	if (features & MAT_FEATURE_INSTANCED)
+		s << "#define INSTANCED 1\n";
+	if (features & MAT_FEATURE_ALBEDO)
+		s << "#define GBUF_ALBEDO 1\n";
+
+	// see internal/_material_inputs.inc
+	if (stage == RENDER_STAGE_VISBUF_RESOLVE)
+		s << "#define VISBUF_RESOLVE 1\n";
+	return s.str();
+}
+
+struct t_program_key
+{
+	t_render_stage stage;
+	uint32_t features;
+	std::vector<std::string> vert_shaders;
+	std::vector<std::string> frag_shaders;
+
+	bool operator< (const t_program_key& k) const
+	{
+		return std::tie(stage, features, vert_shaders, frag_shaders)
+		     < std::tie(k.stage, k.features,
+		                k.vert_shaders, k.frag_shaders);
+	}
+};
+
+/*
+ * Slots are given to the samplers by their names, so that they do not
+ *   depend on the order in which any one material lists its bitmaps
+ */
+static void assign_sampler_slots (t_material_program& p)
+{
+	int num_uniforms = 0;
+	glGetProgramiv(p.id, GL_ACTIVE_UNIFORMS, &num_uniforms);
+
+	for (int i = 0; i < num_uniforms; i++) {
+		char name[256];
+		int size;
+		GLenum type;
+		glGetActiveUniform(p.id, i, sizeof(name), nullptr,
+				&size, &type, name);
+
+		if (type == GL_SAMPLER_2D
+		&& std::string(name).rfind("map_", 0) == 0)
+			p.sampler_slots.push_back({ name, 0 });
+	}
+
+	std::sort(p.sampler_slots.begin(), p.sampler_slots.end());
+
+	int slot = MAT_TEXTURE_SLOT_OFFSET;
+	for (auto& [name, s]: p.sampler_slots) {
+		s = slot++;
+		glUniform1i(glGetUniformLocation(p.id, name.c_str()), s);
+	}
+}
+
+static const t_material_program* get_program (const t_program_key& key)
+{
+	static std::map<t_program_key, t_material_program> cache;
+
+	auto i = cache.find(key);
+	if (i != cache.end())
+		return &i->second;
+
+	std::string defines = program_defines(key.stage, key.features);
+
+	std::vector<GLuint> shaders;
+	for (const std::string& s: key.vert_shaders)
+		shaders.push_back(get_vert_shader(s, defines));
+	for (const std::string& s: key.frag_shaders)
+		shaders.push_back(get_frag_shader(s, defines));
+
+	if (key.stage == RENDER_STAGE_VISBUF_RESOLVE) {
+		// screenspace, over the tiles of the screen
+		shaders.push_back(get_vert_shader("internal/visbuf/tile"));
+		shaders.push_back(get_frag_shader("internal/visbuf/resolve",
+					defines));
+	} else {
+		shaders.push_back(get_vert_shader("internal/material",
+					defines));
+	}
+
+	if (key.stage == RENDER_STAGE_LIGHTING_LSPACE
+	 || key.stage == RENDER_STAGE_DEPTH_PREPASS) {
+		// nothing but the depth
+		shaders.push_back(get_frag_shader("common/null"));
+	} else if (key.stage == RENDER_STAGE_VISIBILITY) {
+		shaders.push_back(get_frag_shader("internal/visbuf/id"));
+	} else {
+		shaders.push_back(get_frag_shader("internal/material",
+					defines));
+	}
+
+	if (key.features & MAT_FEATURE_LAYERED)
+		shaders.push_back(get_geom_shader("internal/light/layered"));
+
+	t_material_program& p = cache[key];
+	p.id = make_glsl_program(shaders);
+
+	glUseProgram(p.id);
+	assign_sampler_slots(p);
+	if (key.stage == RENDER_STAGE_SHADE_FINAL)
+		light_init_material();
+	if (key.stage == RENDER_STAGE_VISBUF_RESOLVE)
+		visbuf_init_resolve();
+
+	// the current program has changed behind the materials' back
+	material_barrier();
+	return &p;
+}
+
+const t_material::t_variant& t_material::get_variant (
+		t_render_stage stage, uint32_t features) const
+{
+	t_variant& v = variants[variant_key(stage, features)];
+
+	// materials which were never loaded have no program at all
+	if (v.program != nullptr || name.empty())
+		return v;
+
+	t_program_key key = { stage, features, vert_shaders, { } };
+	if (stage_uses_surface(stage))
+		key.frag_shaders = frag_shaders;
+	if (stage == RENDER_STAGE_VISBUF_RESOLVE)
+		key.vert_shaders.clear();
+
+	v.program = get_program(key);
+	for (const auto& [sampler, slot]: v.program->sampler_slots) {
+		for (const auto& [uniform, texid]: bitmaps) {
+			if (uniform == sampler)
+				v.textures.push_back({ slot, texid });
+		}
+	}
+
+	return v;
+}
+
 void t_material::load (const std::string& path)
 {
 	std::ifstream f(path);
@@ -34,15 +194,6 @@ void t_material::load (const std::string& path)
 	std::string key;
 	std::string value;
 
-	struct bitmap_desc {
-		std::string loc_name;
-		GLuint texid;
-	};
-	std::vector<bitmap_desc> bitmaps;
-
-	std::vector<GLuint> all_shaders;
-	std::vector<GLuint> vert_shaders;
-
 	while (true) {
 		f >> key >> value;
 		f.ignore(-1, '\n'); // skip to next line
@@ -50,12 +201,9 @@ void t_material::load (const std::string& path)
 			break;
 
 		if (key == "FRAG") {
-			GLuint s = get_frag_shader(value);
-			all_shaders.push_back(s);
+			frag_shaders.push_back(value);
 		} else if (key == "VERT") {
-			GLuint s = get_vert_shader(value);
-			all_shaders.push_back(s);
-			vert_shaders.push_back(s);
+			vert_shaders.push_back(value);
 		} else {
 			key = "map_" + key;
 			bitmaps.push_back({ key, get_texture(value) });
@@ -63,77 +211,74 @@ void t_material::load (const std::string& path)
 	}
 
 	std::sort(vert_shaders.begin(), vert_shaders.end());
-	vert_shaders_hash = hash_int32_vector(vert_shaders);
-
-	all_shaders.push_back(get_frag_shader("internal/material"));
-	all_shaders.push_back(get_vert_shader("internal/material"));
-	program = make_glsl_program(all_shaders);
-	glUseProgram(program);
-
-	glBindAttribLocation(program, ATTRIB_LOC_TANGENT, "tangent");
-
-	int i = MAT_TEXTURE_SLOT_OFFSET;
-	for (const auto& d: bitmaps) {
-		int location = glGetUniformLocation(program,
-				d.loc_name.c_str());
-
-		if (location == -1) {
+	std::sort(frag_shaders.begin(), frag_shaders.end());
+
+	// build the programs which use the whole material right away,
+	// so that any errors in it show up at load time
+	const t_variant& gbuf = get_variant(RENDER_STAGE_G_BUFFERS, 0);
+	const t_variant& shade = get_variant(RENDER_STAGE_SHADE_FINAL, 0);
+
+	for (const auto& b: bitmaps) {
+		auto uses = [&b] (const t_variant& v) {
+			for (const auto& s: v.program->sampler_slots) {
+				if (s.first == b.first)
+					return true;
+			}
+			return false;
+		};
+
+		if (!uses(gbuf) && !uses(shade)) {
 			warning("%s is not a valid uniform in material %s",
-				d.loc_name.c_str(), path.c_str());
-			continue;
+				b.first.c_str(), path.c_str());
 		}
-
-		glUniform1i(location, i++);
-		bitmap_texture_ids.push_back(d.texid);
 	}
-
-	light_init_material();
 }
 
 
 /* Material application is idempotent, so we can avoid redundancy */
 static const t_material* latest_material = nullptr;
-static t_render_stage latest_render_stage;
+static GLuint latest_program = 0;
 void material_barrier ()
 {
 	latest_material = nullptr;
 }
 
-static bool can_skip_application (const t_material* m)
-{
-	t_render_stage s = latest_render_stage;
-	if (s != render_ctx.stage || latest_material == nullptr)
-		return false;
-
-	if (m == latest_material)
-		return true;
-
-	if (s == RENDER_STAGE_LIGHTING_LSPACE || s == RENDER_STAGE_WIREFRAME) {
-		// these render stages only care about user vertex shaders
-		if (latest_material->vert_shaders_hash == m->vert_shaders_hash)
-			return true;
-	}
-
-	return false;
-}
-
 void t_material::apply () const
 {
-	if (!can_skip_application(this)) {
+	uint32_t features = 0;
+	if (render_ctx.layered)
+		features |= MAT_FEATURE_LAYERED;
+	if (render_ctx.instanced)
+		features |= MAT_FEATURE_INSTANCED;
+	if (render_ctx.stage == RENDER_STAGE_G_BUFFERS && gbuffer_composite)
+		features |= MAT_FEATURE_ALBEDO;
+
+	const t_variant& v = get_variant(render_ctx.stage, features);
+	GLuint program = v.program ? v.program->id : 0;
+
+	if (latest_material == nullptr || program != latest_program) {
 		glUseProgram(program);
-		for (int i = 0; i < bitmap_texture_ids.size(); i++) {
-			bind_tex2d_to_slot(MAT_TEXTURE_SLOT_OFFSET + i,
-					bitmap_texture_ids[i]);
-		}
+		latest_program = program;
+		latest_material = nullptr;
+	}
+
+	// in the same program, only the bitmaps differ between materials
+	if (latest_material != this) {
+		for (auto [slot, texid]: v.textures)
+			bind_tex2d_to_slot(slot, texid);
 	}
 
 	render_ctx.submit_matrices();
-	glUniform1i(UNIFORM_LOC_RENDER_STAGE, render_ctx.stage);
+	if (render_ctx.layered)
+		render_ctx.submit_layers();
+
+	if (render_ctx.stage == RENDER_STAGE_SHADE_FINAL)
+		light_apply_material();
 
-	light_apply_material();
+	if (render_ctx.stage == RENDER_STAGE_VISIBILITY)
+		visbuf_use_material(this);
 
 	latest_material = this;
-	latest_render_stage = render_ctx.stage;
 }
 
 
@@ -214,8 +359,10 @@ GLuint make_glsl_program (const std::vector<GLuint>& shaders)
 	int link_success = 0;
 	glGetProgramiv(r, GL_LINK_STATUS, &link_success);
 
-	if (link_success)
+	if (link_success) {
+		uniforms_bind_blocks(r);
 		return r;
+	}
 
 	int log_length = 0;
 	glGetProgramiv(r, GL_INFO_LOG_LENGTH, &log_length);
@@ -230,6 +377,7 @@ GLuint make_glsl_program (const std::vector<GLuint>& shaders)
 
 static bool append_glsl_source (
 		const std::string& start_path, const std::string& path,
+		const std::string& defines,
 		std::ostringstream& src, int depth)
 {
 	static constexpr int maxdepth = 100;
@@ -256,7 +404,7 @@ static bool append_glsl_source (
 			src << "#line 0\n";
 
 			if (!append_glsl_source(start_path, incl_path,
-			                        src, depth + 1))
+			                        "", src, depth + 1))
 				return false;
 
 			src << "\n#line " << linenr+1;
@@ -265,8 +413,10 @@ static bool append_glsl_source (
 		}
 
 		if (line.rfind("#version ", 0) == 0) {
-			// we can only put #line once we're past #version
-			src << "\n#line " << linenr;
+			// we can only put #line (and the #defines, which
+			// are then seen by the whole source) past #version
+			src << '\n' << defines;
+			src << "#line " << linenr;
 		}
 
 		src << '\n';
@@ -275,11 +425,12 @@ static bool append_glsl_source (
 	return true;
 }
 
-GLuint compile_glsl (std::string path, GLenum type)
+GLuint compile_glsl (std::string path, GLenum type,
+		const std::string& defines)
 {
 	std::ostringstream src("");
 
-	if (!append_glsl_source(path, path, src, 0)) {
+	if (!append_glsl_source(path, path, defines, src, 0)) {
 		warning("Failed to compile shader %s", path.c_str());
 		return 0;
 	}
@@ -3,17 +3,64 @@
 
 #include "inc_gl.h"
 #include "render.h"
+#include <unordered_map>
 #include <vector>
 
-struct t_material
+/*
+ * Optional features a material program gets compiled with,
+ *   in addition to the render stage. Bitmask
+ */
+enum t_material_feature: uint32_t
+{
+	/* Emit into the layers of render_ctx (internal/light/layered.geom) */
+	MAT_FEATURE_LAYERED = 1 << 0,
+
+	/* Take the model matrix from ATTRIB_LOC_INSTANCE_MODEL */
+	MAT_FEATURE_INSTANCED = 1 << 1,
+
+	/* Write surface_color() into the G-buffer too (gbuffer_composite) */
+	MAT_FEATURE_ALBEDO = 1 << 2,
+};
+
+/*
+ * A material program for a given render stage and features.
+ * These get compiled with STAGE (and the features) #defined, out of
+ *   only those shaders which the stage needs: e.g. light space depth
+ *   has no use for user fragment shaders. Programs are cached by all
+ *   of the above, so materials which only differ in what the stage
+ *   does not need end up sharing one
+ */
+struct t_material_program
 {
-	GLuint program;
+	GLuint id;
+
+	/* User bitmap samplers (map_*) by name, and their texture slots */
+	std::vector<std::pair<std::string, int>> sampler_slots;
+};
 
+struct t_material
+{
 	std::string name;
-	std::vector<GLuint> bitmap_texture_ids;
 
-	/* Vertex shader IDs hashed - needed for idempotency check */
-	uint32_t vert_shaders_hash;
+	/* User shaders, by name, sorted */
+	std::vector<std::string> vert_shaders;
+	std::vector<std::string> frag_shaders;
+
+	/* User bitmaps, by the name of their sampler uniform */
+	std::vector<std::pair<std::string, GLuint>> bitmaps;
+
+	struct t_variant
+	{
+		const t_material_program* program = nullptr;
+
+		/* Slot and texture ID for each bitmap the program uses */
+		std::vector<std::pair<int, GLuint>> textures;
+	};
+
+	/* Built lazily, by stage and features (see variant_key) */
+	mutable std::unordered_map<uint32_t, t_variant> variants;
+	const t_variant& get_variant (t_render_stage stage,
+			uint32_t features) const;
 
 	void load (const std::string& path);
 	void apply () const;
@@ -45,6 +92,7 @@ constexpr int MAT_TEXTURE_SLOT_OFFSET = 2;
 
 
 GLuint make_glsl_program (const std::vector<GLuint>& shaders);
-GLuint compile_glsl (std::string path, GLenum shadertype);
+GLuint compile_glsl (std::string path, GLenum shadertype,
+		const std::string& defines = "");
 
 #endif // MATERIAL_H
@@ -6,39 +6,35 @@
 #include <cassert>
 #include <map>
 
-void t_model_mem::gl_send_triangle (int tri_id) const
+std::vector<t_mesh_vertex> t_model_mem::mesh_vertices () const
 {
-	for (int i = 0; i < 3; i++) {
-		int idx = triangles[tri_id].index[i];
-
-		const vec3& p = vertices[idx].v.pos;
-		const vec3& n = vertices[idx].v.norm;
-		const vec2& t = vertices[idx].v.tex;
-		const vec3& tg = vertices[idx].tangent;
-
-		glNormal3f(n.x, n.y, n.z);
-		glVertexAttrib3f(ATTRIB_LOC_TANGENT, tg.x, tg.y, tg.z);
-		glTexCoord2f(t.x, 1.0 - t.y);
-		glVertex3f(p.x, p.y, p.z);
+	std::vector<t_mesh_vertex> ret;
+	ret.reserve(vertices.size());
+
+	for (const vertex& v: vertices) {
+		vec2 tex = { v.v.tex.x, 1.0 - v.v.tex.y };
+		ret.push_back({ v.v.pos, v.v.norm, tex, v.tangent });
 	}
+
+	return ret;
 }
 
 void t_model::render () const
 {
-	glCallList(display_list_id);
+	mesh.bind();
+	mesh.draw(0, mesh.num_indices);
 }
 
 void t_model::load (const t_model_mem& src)
 {
-	display_list_id = glGenLists(1);
-	glNewList(display_list_id, GL_COMPILE);
-	glBegin(GL_TRIANGLES);
-	int n = src.triangles.size();
-	for (int i = 0; i < n; i++)
-		src.gl_send_triangle(i);
-	glEnd();
-	glEndList();
+	std::vector<uint32_t> indices;
+	indices.reserve(3 * src.triangles.size());
+	for (const auto& tri: src.triangles) {
+		for (int i = 0; i < 3; i++)
+			indices.push_back(tri.index[i]);
+	}
 
+	mesh.load(src.mesh_vertices(), indices);
 	bbox = src.bbox;
 }
 
@@ -2,6 +2,7 @@
 #define MODEL_H
 
 #include "material.h"
+#include "geometry.h"
 #include "core/core.h"
 #include <vector>
 
@@ -38,7 +39,8 @@ struct t_model_mem
 	const t_vertex& get_vertex (int tri, int vert) const
 	{ return vertices[triangles[tri].index[vert]].v; }
 
-	void gl_send_triangle (int tri_id) const;
+	/* All the vertices, as they go into a t_mesh */
+	std::vector<t_mesh_vertex> mesh_vertices () const;
 
 	void load_obj (const std::string& path);
 
@@ -64,7 +66,7 @@ struct t_model_mem
  */
 struct t_model
 {
-	GLuint display_list_id;
+	t_mesh mesh;
 
 	t_bound_box bbox;
 
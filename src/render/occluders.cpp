@@ -0,0 +1,265 @@
+#include "render/vis.h"
+#include <algorithm>
+#include <array>
+#include <map>
+#include <numeric>
+
+int occ_auto_budget = 0;
+float occ_auto_min_area = 1024.0;
+
+int occ_auto_generated = 0;
+int occ_auto_triangles = 0;
+
+/* How deep behind an occluder the back of its solid is looked for */
+constexpr float OCC_AUTO_MAX_THICKNESS = 64.0;
+constexpr int OCC_AUTO_MAX_VERTICES = 8;
+
+/* How far apart two areas may be and still be taken as the same */
+constexpr float OCC_AUTO_AREA_TOLERANCE = 1e-4;
+
+extern t_model_mem world;
+
+struct t_occluder_candidate
+{
+	std::vector<vec3> polygon;
+	float area;
+};
+
+static int find_set (std::vector<int>& parent, int i)
+{
+	while (parent[i] != i)
+		i = parent[i] = parent[parent[i]];
+	return i;
+}
+
+static float cross_2d (const vec2& o, const vec2& a, const vec2& b)
+{
+	return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+/* Counterclockwise, by the monotone chain */
+static std::vector<vec2> convex_hull (std::vector<vec2> pts)
+{
+	std::sort(pts.begin(), pts.end(), [] (const vec2& a, const vec2& b) {
+		return a.x < b.x || (a.x == b.x && a.y < b.y);
+	});
+	if (pts.size() < 3)
+		return { };
+
+	std::vector<vec2> h(pts.size() * 2);
+	size_t k = 0;
+	for (size_t i = 0; i < pts.size(); i++) {
+		while (k >= 2 && cross_2d(h[k - 2], h[k - 1], pts[i]) <= 0.0)
+			k--;
+		h[k++] = pts[i];
+	}
+	for (size_t i = pts.size() - 1, lower = k + 1; i > 0; i--) {
+		while (k >= lower
+		    && cross_2d(h[k - 2], h[k - 1], pts[i - 1]) <= 0.0)
+			k--;
+		h[k++] = pts[i - 1];
+	}
+	h.resize(k - 1);
+	return h;
+}
+
+static float polygon_area (const std::vector<vec2>& p)
+{
+	float a = 0.0;
+	for (size_t i = 0; i < p.size(); i++)
+		a += cross_2d(vec2(0.0), p[i], p[(i + 1) % p.size()]);
+	return a * 0.5f;
+}
+
+/*
+ * Dropping a corner of a convex polygon leaves one inside it, so the
+ *   cheapest ones go until few enough are left
+ */
+static void simplify (std::vector<vec2>& p)
+{
+	while (p.size() > OCC_AUTO_MAX_VERTICES) {
+		size_t best = 0;
+		float best_area = INFINITY;
+		for (size_t i = 0; i < p.size(); i++) {
+			float a = cross_2d(p[(i + p.size() - 1) % p.size()], p[i],
+					p[(i + 1) % p.size()]);
+			if (a < best_area) {
+				best_area = a;
+				best = i;
+			}
+		}
+		p.erase(p.begin() + best);
+	}
+}
+
+/*
+ * How far behind the polygon the back of the solid it is the face of
+ *   is, at its least; -1 if there does not seem to be one
+ */
+static float backing_thickness (const std::vector<vec3>& polygon,
+		const vec3& normal)
+{
+	vec3 centroid = std::accumulate(polygon.begin(), polygon.end(),
+			vec3(0.0)) / float(polygon.size());
+
+	std::vector<vec3> samples = { centroid };
+	for (const vec3& p: polygon)
+		samples.push_back(glm::mix(p, centroid, 0.1f));
+
+	float thickness = OCC_AUTO_MAX_THICKNESS;
+	for (const vec3& s: samples) {
+		float t;
+		int hit = vis_segment_hit(s,
+				s - normal * OCC_AUTO_MAX_THICKNESS, 0.01, &t);
+		if (hit < 0 || world.triangles[hit].material == mat_none)
+			return -1.0;
+
+		const vec3& p0 = world.get_vertex(hit, 0).pos;
+		const vec3& p1 = world.get_vertex(hit, 1).pos;
+		const vec3& p2 = world.get_vertex(hit, 2).pos;
+		if (glm::dot(glm::cross(p1 - p0, p2 - p0), normal) >= 0.0)
+			return -1.0;
+
+		thickness = std::min(thickness, t * OCC_AUTO_MAX_THICKNESS);
+	}
+	return thickness;
+}
+
+/* The triangles of one plane, in pieces which share vertices */
+static void plane_candidates (const std::vector<int>& tris,
+		const vec3& normal, std::vector<t_occluder_candidate>& out)
+{
+	std::map<std::array<int, 3>, int> vertex_ids;
+	std::vector<int> parent;
+	std::vector<int> tri_vertex(tris.size());
+
+	for (size_t i = 0; i < tris.size(); i++) {
+		int first = -1;
+		for (int j = 0; j < 3; j++) {
+			ivec3 q = glm::round(world.get_vertex(tris[i], j).pos
+					* 16.0f);
+			auto [it, added] = vertex_ids.insert(
+				{ { q.x, q.y, q.z }, (int) parent.size() });
+			if (added)
+				parent.push_back(it->second);
+			if (first < 0)
+				first = find_set(parent, it->second);
+			else
+				parent[find_set(parent, it->second)] = first;
+		}
+		tri_vertex[i] = first;
+	}
+
+	std::map<int, std::vector<int>> pieces;
+	for (size_t i = 0; i < tris.size(); i++)
+		pieces[find_set(parent, tri_vertex[i])].push_back(tris[i]);
+
+	vec3 u = glm::normalize(std::abs(normal.z) < 0.9
+		? glm::cross(normal, vec3(0.0, 0.0, 1.0))
+		: glm::cross(normal, vec3(1.0, 0.0, 0.0)));
+	vec3 v = glm::cross(normal, u);
+
+	for (const auto& [id, piece]: pieces) {
+		vec3 origin = world.get_vertex(piece[0], 0).pos;
+
+		float tri_area = 0.0;
+		std::vector<vec2> pts;
+		for (int tri: piece) {
+			vec2 p[3];
+			for (int j = 0; j < 3; j++) {
+				vec3 d = world.get_vertex(tri, j).pos - origin;
+				p[j] = { glm::dot(d, u), glm::dot(d, v) };
+				pts.push_back(p[j]);
+			}
+			tri_area += std::abs(cross_2d(p[0], p[1], p[2])) * 0.5f;
+		}
+
+		// holes, notches, or whatever else there is to see through,
+		// which overlapping triangles could make up for in area
+		std::vector<vec2> hull = convex_hull(pts);
+		float hull_area = polygon_area(hull);
+		if (hull.size() < 3 || std::abs(tri_area - hull_area)
+				> hull_area * OCC_AUTO_AREA_TOLERANCE)
+			continue;
+
+		simplify(hull);
+		float area = polygon_area(hull);
+		if (area < occ_auto_min_area)
+			continue;
+
+		t_occluder_candidate c;
+		c.area = area;
+		for (const vec2& p: hull)
+			c.polygon.push_back(origin + u * p.x + v * p.y);
+
+		float thickness = backing_thickness(c.polygon, normal);
+		if (thickness < 0.0)
+			continue;
+
+		// into the solid, clear of the face's own depth
+		for (vec3& p: c.polygon)
+			p -= normal * (thickness * 0.5f);
+		out.push_back(std::move(c));
+	}
+}
+
+void vis_generate_occluders (std::vector<float>& occ_planes)
+{
+	occ_auto_generated = 0;
+	occ_auto_triangles = 0;
+	if (occ_auto_budget <= 0)
+		return;
+
+	// by plane, as the normal and distance, rounded off
+	std::map<std::array<int, 4>, std::vector<int>> planes;
+	std::map<std::array<int, 4>, vec3> plane_normals;
+
+	for (size_t i = 0; i < world.triangles.size(); i++) {
+		const t_material* mat = world.triangles[i].material;
+		if (mat == mat_occlude || mat == mat_none)
+			continue;
+
+		const vec3& p0 = world.get_vertex(i, 0).pos;
+		const vec3& p1 = world.get_vertex(i, 1).pos;
+		const vec3& p2 = world.get_vertex(i, 2).pos;
+		vec3 c = glm::cross(p1 - p0, p2 - p0);
+		if (glm::length(c) < 1e-6)
+			continue;
+
+		vec3 n = glm::normalize(c);
+		ivec3 qn = glm::round(n * 256.0f);
+		int qd = std::round(glm::dot(n, p0) * 4.0f);
+		std::array<int, 4> key = { qn.x, qn.y, qn.z, qd };
+		planes[key].push_back(i);
+		plane_normals.insert({ key, n });
+	}
+
+	std::vector<t_occluder_candidate> candidates;
+	for (const auto& [key, tris]: planes)
+		plane_candidates(tris, plane_normals[key], candidates);
+
+	std::stable_sort(candidates.begin(), candidates.end(),
+		[] (const t_occluder_candidate& a,
+		    const t_occluder_candidate& b) {
+			return a.area > b.area;
+		});
+
+	int used = 0;
+	int num_occluders = 0;
+	for (const t_occluder_candidate& c: candidates) {
+		int tris = c.polygon.size() - 2;
+		if (used + tris > occ_auto_budget)
+			continue;
+
+		for (size_t i = 1; i + 1 < c.polygon.size(); i++) {
+			for (const vec3& p: { c.polygon[0], c.polygon[i],
+			                      c.polygon[i + 1] })
+				occ_planes.insert(occ_planes.end(), { p.x, p.y, p.z });
+		}
+		used += tris;
+		num_occluders++;
+	}
+
+	occ_auto_generated = num_occluders;
+	occ_auto_triangles = used;
+}
@@ -0,0 +1,311 @@
+#include "render/pvs.h"
+#include "render/vis.h"
+#include "input/cmds.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+int pvs_cell_size = 128;
+int pvs_samples = 32;
+
+static bool pvs_disabled = false;
+COMMAND_SET_BOOL (vis_no_pvs, pvs_disabled);
+
+extern t_model_mem world;
+
+/*
+ * The cells, cubes of cell_size from start on, in X, then Y, then Z
+ *   order, with the set of each, compressed
+ */
+static struct {
+	bool loaded = false;
+	int num_leaves;
+	vec3 start;
+	float cell_size;
+	ivec3 dims;
+	std::vector<std::vector<uint8_t>> sets;
+} pvs;
+
+/* The set of the latest cell asked about, as counts of the leaves up to */
+static int cached_cell = -1;
+static std::vector<int> cached_counts;
+
+/*
+ * Runs of zero bytes, which most of the sets are, become a zero
+ *   and the length of the run; other bytes stay as they are
+ */
+static std::vector<uint8_t> compress (const std::vector<uint8_t>& bits)
+{
+	std::vector<uint8_t> r;
+	for (size_t i = 0; i < bits.size(); ) {
+		if (bits[i] != 0) {
+			r.push_back(bits[i++]);
+			continue;
+		}
+		int run = 0;
+		while (i < bits.size() && bits[i] == 0 && run < 255) {
+			i++;
+			run++;
+		}
+		r.insert(r.end(), { 0, (uint8_t) run });
+	}
+	return r;
+}
+
+static std::vector<uint8_t> decompress (const std::vector<uint8_t>& c,
+		int num_bytes)
+{
+	std::vector<uint8_t> r;
+	r.reserve(num_bytes);
+	for (size_t i = 0; i < c.size(); i++) {
+		if (c[i] != 0)
+			r.push_back(c[i]);
+		else if (i + 1 < c.size())
+			r.insert(r.end(), c[++i], 0);
+	}
+	r.resize(num_bytes, 0);
+	return r;
+}
+
+static int cell_of (const vec3& p)
+{
+	ivec3 c = glm::floor((p - pvs.start) / pvs.cell_size);
+	if (glm::any(glm::lessThan(c, ivec3(0)))
+	 || glm::any(glm::greaterThanEqual(c, pvs.dims)))
+		return -1;
+	return (c.z * pvs.dims.y + c.y) * pvs.dims.x + c.x;
+}
+
+static t_bound_box cell_bounds (int i)
+{
+	ivec3 c = { i % pvs.dims.x, (i / pvs.dims.x) % pvs.dims.y,
+	            i / (pvs.dims.x * pvs.dims.y) };
+	vec3 start = pvs.start + vec3(c) * pvs.cell_size;
+	return { start, start + vec3(pvs.cell_size) };
+}
+
+bool pvs_may_see (const vec3& eye, int first_leaf, int end_leaf)
+{
+	if (!pvs.loaded || pvs_disabled)
+		return true;
+
+	int cell = cell_of(eye);
+	if (cell < 0)
+		return true;
+
+	if (cell != cached_cell) {
+		std::vector<uint8_t> bits = decompress(pvs.sets[cell],
+				(pvs.num_leaves + 7) / 8);
+		cached_counts.assign(pvs.num_leaves + 1, 0);
+		for (int i = 0; i < pvs.num_leaves; i++) {
+			cached_counts[i + 1] = cached_counts[i]
+				+ ((bits[i / 8] >> (i % 8)) & 1);
+		}
+		cached_cell = cell;
+	}
+
+	return cached_counts[end_leaf] > cached_counts[first_leaf];
+}
+
+bool pvs_cell_set (const vec3& eye, std::vector<uint32_t>& words)
+{
+	if (!pvs.loaded || pvs_disabled)
+		return false;
+
+	int cell = cell_of(eye);
+	if (cell < 0)
+		return false;
+
+	std::vector<uint8_t> bits = decompress(pvs.sets[cell],
+			(pvs.num_leaves + 7) / 8);
+	words.assign((bits.size() + 3) / 4, 0);
+	for (size_t i = 0; i < bits.size(); i++)
+		words[i / 4] |= (uint32_t) bits[i] << (8 * (i % 4));
+	return true;
+}
+
+void pvs_free ()
+{
+	pvs.loaded = false;
+	pvs.sets.clear();
+	cached_cell = -1;
+}
+
+/*
+ * File layout: the number of leaves, the start of the cells, their
+ *   size and how many along each axis, then each cell's compressed
+ *   set, as its length in bytes and then those
+ */
+void pvs_load (const std::string& path)
+{
+	pvs_free();
+
+	std::ifstream f(path, std::ios::binary);
+	if (!f)
+		return;
+
+	int32_t num_leaves = 0;
+	f.read((char*) &num_leaves, sizeof(num_leaves));
+	f.read((char*) &pvs.start, sizeof(pvs.start));
+	f.read((char*) &pvs.cell_size, sizeof(pvs.cell_size));
+	f.read((char*) &pvs.dims, sizeof(pvs.dims));
+	if (!f) {
+		warning("PVS %s is cut short", path.c_str());
+		return;
+	}
+
+	if (num_leaves != all_leaves.leaves.size()) {
+		warning("PVS %s was baked for another octree; "
+			"run vis_bake_pvs again", path.c_str());
+		return;
+	}
+	pvs.num_leaves = num_leaves;
+
+	// the cells pvs_bake() would lay out over this world
+	bool fits = pvs.cell_size >= 1.0 && pvs.start == world.bbox.start;
+	if (fits) {
+		fits = pvs.dims == glm::max(ivec3(glm::ceil(
+			(world.bbox.end - world.bbox.start) / pvs.cell_size)), 1);
+	}
+	if (!fits) {
+		warning("PVS %s was baked for other bounds; "
+			"run vis_bake_pvs again", path.c_str());
+		return;
+	}
+
+	// at worst, every byte of a set is a zero of its own
+	uint32_t max_size = 2 * ((pvs.num_leaves + 7) / 8);
+
+	int num_cells = pvs.dims.x * pvs.dims.y * pvs.dims.z;
+	pvs.sets.resize(num_cells);
+	for (auto& s: pvs.sets) {
+		uint32_t size = 0;
+		f.read((char*) &size, sizeof(size));
+		if (size > max_size)
+			f.setstate(std::ios::failbit);
+		if (!f)
+			break;
+		s.resize(size);
+		f.read((char*) s.data(), size);
+	}
+
+	if (!f) {
+		warning("PVS %s is cut short, or broken", path.c_str());
+		pvs.sets.clear();
+		return;
+	}
+	pvs.loaded = true;
+}
+
+static vec3 random_in (const t_bound_box& b, std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> u(0.0, 1.0);
+	return glm::mix(b.start, b.end, vec3(u(rng), u(rng), u(rng)));
+}
+
+static vec3 random_on_triangle (int tri, std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> u(0.0, 1.0);
+	float r1 = std::sqrt(u(rng));
+	float r2 = u(rng);
+	return world.get_vertex(tri, 0).pos * (1.0f - r1)
+	     + world.get_vertex(tri, 1).pos * (r1 * (1.0f - r2))
+	     + world.get_vertex(tri, 2).pos * (r1 * r2);
+}
+
+static bool cell_sees_leaf (const t_bound_box& cell, const oct_node* l,
+		std::mt19937& rng)
+{
+	if (cell.intersects(l->bounds))
+		return true;
+
+	for (int i = 0; i < pvs_samples; i++) {
+		// the triangles, and the entities which may be anywhere
+		vec3 to;
+		if (i % 2 == 0 && !l->bucket.empty()) {
+			std::uniform_int_distribution<int> pick(
+				0, l->bucket.size() - 1);
+			to = random_on_triangle(l->bucket[pick(rng)], rng);
+		} else {
+			to = random_in(l->bounds, rng);
+		}
+
+		// the target is on a triangle, which must not count
+		if (vis_segment_hit(random_in(cell, rng), to, 0.01) < 0)
+			return true;
+	}
+	return false;
+}
+
+void pvs_bake (const std::string& path)
+{
+	namespace cr = std::chrono;
+	auto started = cr::steady_clock::now();
+
+	pvs_free();
+
+	const std::vector<const oct_node*>& leaves = all_leaves.leaves;
+	pvs.num_leaves = leaves.size();
+	pvs.start = world.bbox.start;
+	pvs.cell_size = pvs_cell_size;
+	pvs.dims = glm::max(ivec3(glm::ceil(
+		(world.bbox.end - world.bbox.start) / pvs.cell_size)), 1);
+
+	int num_cells = pvs.dims.x * pvs.dims.y * pvs.dims.z;
+	pvs.sets.assign(num_cells, { });
+
+	std::atomic<int> next_cell = 0;
+	auto work = [&] (int seed) -> void {
+		std::mt19937 rng(seed);
+		std::vector<uint8_t> bits;
+
+		for (int c; (c = next_cell++) < num_cells; ) {
+			t_bound_box cell = cell_bounds(c);
+			bits.assign((leaves.size() + 7) / 8, 0);
+			for (int i = 0; i < leaves.size(); i++) {
+				if (cell_sees_leaf(cell, leaves[i], rng))
+					bits[i / 8] |= 1 << (i % 8);
+			}
+			pvs.sets[c] = compress(bits);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	int num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	for (int i = 0; i < num_threads; i++)
+		threads.emplace_back(work, i + 1);
+	for (std::thread& t: threads)
+		t.join();
+
+	std::ofstream f(path, std::ios::binary);
+	if (!f) {
+		warning("PVS: could not open %s for writing", path.c_str());
+		pvs.sets.clear();
+		return;
+	}
+
+	int32_t num_leaves = pvs.num_leaves;
+	f.write((const char*) &num_leaves, sizeof(num_leaves));
+	f.write((const char*) &pvs.start, sizeof(pvs.start));
+	f.write((const char*) &pvs.cell_size, sizeof(pvs.cell_size));
+	f.write((const char*) &pvs.dims, sizeof(pvs.dims));
+
+	size_t total = 0;
+	for (const auto& s: pvs.sets) {
+		uint32_t size = s.size();
+		f.write((const char*) &size, sizeof(size));
+		f.write((const char*) s.data(), size);
+		total += size;
+	}
+
+	pvs.loaded = true;
+
+	float secs = cr::duration<float>(
+		cr::steady_clock::now() - started).count();
+	std::cout << "PVS: " << num_cells << " cells, " << leaves.size()
+		<< " leaves, " << total << " bytes, baked in " << secs
+		<< " s on " << num_threads << " threads" << std::endl;
+}
@@ -0,0 +1,52 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include "core/core.h"
+#include <string>
+
+/*
+ * Potentially visible sets, baked for the static world.
+ *
+ * The world's bounds get split into cubic cells (vis data option
+ *   pvs_cell, their size), and for each cell, the octree leaves which
+ *   can be seen from anywhere in it are found by sampling: rays from
+ *   random points of the cell to random points of the leaf (on its
+ *   triangles and inside its bounds), pvs_samples of them at most,
+ *   cast against the world's triangles. A leaf is seen if any gets
+ *   through.
+ * vis_bake_pvs does that for the loaded map, on all the cores, and
+ *   saves the sets as the map's pvs file, next to geo.obj and vis,
+ *   run-length compressed. The file only fits the octree it was baked
+ *   with, so changing the geometry or vis means baking it again.
+ *
+ * With one, fill() only walks down into those nodes which have a leaf
+ *   that the eye's cell may see, so the occlusion queries, and all,
+ *   only get made for them. In the GPU driven mode (render/vis.h),
+ *   internal/vis_cull.comp gets the cell's set, and tests the leaf of
+ *   each bucket against it instead
+ */
+
+extern int pvs_cell_size;
+extern int pvs_samples;
+
+/* Called as the octree is built, or torn down */
+void pvs_load (const std::string& path);
+void pvs_free ();
+
+/* Bake for the current octree, save to path, and use it */
+void pvs_bake (const std::string& path);
+
+/*
+ * Whether any of the leaves from first to end (in all_leaves order) is
+ *   in the set for the point's cell. Always so without a PVS, or out
+ *   of the cells
+ */
+bool pvs_may_see (const vec3& eye, int first_leaf, int end_leaf);
+
+/*
+ * The set for the point's cell, a bit for each leaf, in 32-bit words;
+ *   false, leaving it as it is, when pvs_may_see() would always be so
+ */
+bool pvs_cell_set (const vec3& eye, std::vector<uint32_t>& words);
+
+#endif // PVS_H
@@ -5,8 +5,12 @@
 #include "render/vis.h"
 #include "render/framebuffer.h"
 #include "render/gbuffer.h"
+#include "render/visbuf.h"
+#include "render/impostor.h"
 #include "render/debug.h"
+#include "render/ubo.h"
 #include "render/light/all.h"
+#include "render/light/cone.h"
 #include "render/light/sun.h"
 #include <cassert>
 #include <chrono>
@@ -23,8 +27,15 @@ void render_all ()
 	static float last_frame_time = -1.0;
 
 	camera.apply();
+	uniforms_begin_frame({ render_ctx.proj, render_ctx.view,
+	                       vec4(render_ctx.eye_pos, 1.0),
+	                       glm::inverse(render_ctx.proj * render_ctx.view) });
+	impostors_bake();
 
 	visible_set.fill();
+	visible_set.set_contribution(
+		render_ctx.proj[1][1] * sdlctx.res_y * 0.5f,
+		false, render_ctx.eye_pos);
 
 	fill_gbuffers();
 	compute_all_lighting();
@@ -35,7 +46,10 @@ void render_all ()
 
 	render_ctx.stage = RENDER_STAGE_SHADE_FINAL;
 	render_sky();
-	visible_set.render();
+	if (gbuffer_composite)
+		gbuffer_composite_pass();
+	else
+		visible_set.render();
 	visible_set.render_debug();
 
 	// HUD
@@ -48,6 +62,11 @@ void render_all ()
 	if (int err = glGetError(); err != 0)
 		warning("OpenGL error 0x%x (%i)", err, err);
 
+	uniforms_end_frame();
+
+	last_frame_stats = frame_stats;
+	frame_stats = { };
+
 	last_frame_time = cr::duration<float>(sc::now() - frame_start).count();
 	SDL_GL_SwapWindow(sdlctx.window);
 }
@@ -116,11 +135,15 @@ void init_render ()
 	extern void init_text ();
 
 	init_cuboid();
+	init_uniform_buffers();
 	init_render_debug();
 	init_materials();
 	init_text();
 	init_vis();
+	visible_set.occ_any_view = true;
 	init_gbuffers();
+	init_visbuf();
+	init_impostors();
 	init_lighting();
 	init_sky();
 }
@@ -141,6 +164,30 @@ void resize_window (int w, int h)
 	SDL_SetWindowSize(sdlctx.window, w, h);
 }
 
+COMMAND_ROUTINE (render_stats)
+{
+	if (ev != PRESS)
+		return;
+
+	const t_frame_stats& s = last_frame_stats;
+	std::cout << "draw calls " << s.draw_calls
+		<< ", of them instanced " << s.instanced_draws
+		<< " drawing " << s.instances << " instances"
+		<< " (" << s.instances - s.instanced_draws << " calls saved)"
+		<< std::endl;
+	std::cout << "world clusters culled facing away "
+		<< s.clusters_culled << ", culled too small or far "
+		<< s.contrib_culled << std::endl;
+	std::cout << "entities culled outside the view "
+		<< s.entities_outside << ", occluded "
+		<< s.entities_occluded << std::endl;
+	std::cout << "impostors " << s.impostors << std::endl;
+	std::cout << "lighting took " << light_gpu_time << " ms on the GPU"
+		<< ", for " << lights_cone.size() << " cone and "
+		<< lights_sun.size() << " sun lights in " << s.light_passes
+		<< " passes" << std::endl;
+}
+
 COMMAND_ROUTINE (windowsize)
 {
 	if (ev != PRESS)
@@ -153,8 +200,8 @@ COMMAND_ROUTINE (windowsize)
 }
 
 
-GLuint cuboid_dlist_inwards;
-GLuint cuboid_dlist_outwards;
+t_simple_vao cuboid_inwards;
+t_simple_vao cuboid_outwards;
 void init_cuboid ()
 {
 	vec3 p[8];
@@ -163,44 +210,42 @@ void init_cuboid ()
 		         i & 2 ? 1.0f : -1.0f,
 		         i & 4 ? 1.0f : -1.0f };
 	}
-	auto quad = [&p] (int a, int b, int c, int d)
+
+	std::vector<float> v;
+	auto quad = [&p, &v] (int a, int b, int c, int d)
 	-> void {
-		glVertex3f(p[a].x, p[a].y, p[a].z);
-		glVertex3f(p[b].x, p[b].y, p[b].z);
-		glVertex3f(p[c].x, p[c].y, p[c].z);
-		glVertex3f(p[d].x, p[d].y, p[d].z);
+		// as two triangles, abc and acd
+		for (int i: { a, b, c, a, c, d })
+			v.insert(v.end(), { p[i].x, p[i].y, p[i].z });
 	};
 
-	cuboid_dlist_inwards = glGenLists(2);
-	cuboid_dlist_outwards = cuboid_dlist_inwards + 1;
-
-	glNewList(cuboid_dlist_inwards, GL_COMPILE);
-	glBegin(GL_QUADS);
 	quad(1, 3, 2, 0);
 	quad(4, 5, 1, 0);
 	quad(2, 6, 4, 0);
 	quad(3, 1, 5, 7);
 	quad(6, 2, 3, 7);
 	quad(5, 4, 6, 7);
-	glEnd();
-	glEndList();
+	cuboid_inwards.make({ { ATTRIB_LOC_POSITION, 3 } }).upload(v);
 
-	glNewList(cuboid_dlist_outwards, GL_COMPILE);
-	glBegin(GL_QUADS);
+	v.clear();
 	quad(0, 2, 3, 1);
 	quad(0, 1, 5, 4);
 	quad(0, 4, 6, 2);
 	quad(7, 5, 1, 3);
 	quad(7, 3, 2, 6);
 	quad(7, 6, 4, 5);
-	glEnd();
-	glEndList();
+	cuboid_outwards.make({ { ATTRIB_LOC_POSITION, 3 } }).upload(v);
 }
 
 
 GLuint text_texture;
 unsigned int text_program;
 unsigned int text_prg_glyph_loc;
+static t_simple_vao text_vao;
+
+static GLuint flat_program;
+static t_simple_vao flat_vao;
+static constexpr int UNIFORM_LOC_FLAT_COLOR = 0;
 
 void init_text ()
 {
@@ -220,6 +265,13 @@ void init_text ()
 			{ get_vert_shader("internal/text"),
 			  get_frag_shader("internal/text") });
 	text_prg_glyph_loc = glGetUniformLocation(text_program, "glyphs");
+	text_vao.make({ { ATTRIB_LOC_POSITION, 2 },
+	                { ATTRIB_LOC_TEXCOORD, 2 } });
+
+	flat_program = make_glsl_program(
+			{ get_vert_shader("internal/flat"),
+			  get_frag_shader("internal/flat") });
+	flat_vao.make({ { ATTRIB_LOC_POSITION, 2 } });
 
 	char all_chars[257];
 	all_chars[0] = '~';
@@ -254,23 +306,44 @@ void draw_text (const char* str, float x, float y, float charw, float charh)
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, text_texture);
 	glUniform1i(text_prg_glyph_loc, 0);
 
-	glBegin(GL_QUADS);
 	int w = sdlctx.font_w;
 	int h = sdlctx.font_h;
 
+	// position and texcoord of each corner, two triangles per glyph
+	std::vector<float> v;
 	for (int i = 0; str[i] != 0; i++) {
-		const char c = str[i];
-		glTexCoord2i(w * c, 0);
-		glVertex2f(x, y);
-		glTexCoord2i(w * c, h);
-		glVertex2f(x, y - charh);
-		glTexCoord2i(w * (c + 1), h);
-		glVertex2f(x + charw, y - charh);
-		glTexCoord2i(w * (c + 1), 0);
-		glVertex2f(x + charw, y);
+		const float c = (unsigned char) str[i];
+		const float corners[4][4] = {
+			{ x, y, w * c, 0 },
+			{ x, y - charh, w * c, (float) h },
+			{ x + charw, y - charh, w * (c + 1), (float) h },
+			{ x + charw, y, w * (c + 1), 0 },
+		};
+		for (int j: { 0, 1, 2, 0, 2, 3 })
+			v.insert(v.end(), corners[j], corners[j] + 4);
 		x += charw;
 	}
-	glEnd();
+
+	text_vao.upload(v).draw();
+}
+
+static void draw_flat (GLenum mode, std::vector<float> v, SDL_Color c)
+{
+	glUseProgram(flat_program);
+	glUniform4f(UNIFORM_LOC_FLAT_COLOR, c.r / 255.0, c.g / 255.0,
+			c.b / 255.0, c.a / 255.0);
+	flat_vao.upload(v).draw(mode);
+}
+
+void draw_rect (float x0, float y0, float x1, float y1, SDL_Color c)
+{
+	draw_flat(GL_TRIANGLES, { x0, y0, x1, y0, x1, y1,
+	                          x0, y0, x1, y1, x0, y1 }, c);
+}
+
+void draw_line (float x0, float y0, float x1, float y1, SDL_Color c)
+{
+	draw_flat(GL_LINES, { x0, y0, x1, y1 }, c);
 }
 
 void bind_to_slot (int slot, GLenum target, GLuint tex)
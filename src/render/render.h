@@ -5,6 +5,7 @@
 #include "inc_gl.h"
 #include "misc.h"
 #include "render/ctx.h"
+#include "render/geometry.h"
 
 
 struct t_sdlcontext
@@ -33,6 +34,10 @@ void resize_window (int w, int h);
 const SDL_Color text_color = { 200, 200, 200, 255 };
 void draw_text (const char* text, float x, float y, float charw, float charh);
 
+/* Flat colored 2D shapes in normalized device coordinates */
+void draw_rect (float x0, float y0, float x1, float y1, SDL_Color c);
+void draw_line (float x0, float y0, float x1, float y1, SDL_Color c);
+
 
 void bind_to_slot (int slot, GLenum target, GLuint tex);
 inline void bind_tex2d_to_slot (int slot, GLuint tex)
@@ -41,7 +46,8 @@ inline void bind_tex2d_to_slot (int slot, GLuint tex)
 }
 
 
-extern GLuint cuboid_dlist_inwards;
-extern GLuint cuboid_dlist_outwards;
+/* The [-1, 1] cube, with the faces looking inwards or outwards */
+extern t_simple_vao cuboid_inwards;
+extern t_simple_vao cuboid_outwards;
 
 #endif // RENDER_H
@@ -1,4 +1,5 @@
 #include "resource.h"
+#include "settings.h"
 
 t_cache_mdl cache_mdl;
 t_cache_tex cache_tex;
@@ -20,13 +21,17 @@ t_model* get_model (std::string path)
 
 	ret = new t_model;
 
-	path = PATH_MODEL + path + ".rvd";
 	t_model_mem verts;
-	verts.load_rvd(path);
+	load_model_mem(path, verts);
 	ret->load(verts);
 	return ret;
 }
 
+void load_model_mem (const std::string& name, t_model_mem& dest)
+{
+	dest.load_rvd(PATH_MODEL + name + ".rvd");
+}
+
 GLuint get_texture (std::string path)
 {
 	GLuint& ret = cache_tex[path];
@@ -41,9 +46,13 @@ GLuint get_texture (std::string path)
 	return ret;
 }
 
-GLuint get_shader (const std::string& path, GLenum type)
+GLuint get_shader (const std::string& path, GLenum type,
+		const std::string& extra_defines)
 {
-	GLuint& ret = cache_shader[path];
+	// the same file with different #defines is a different shader,
+	// and the settings are seen by every one
+	std::string defines = render_settings_defines() + extra_defines;
+	GLuint& ret = cache_shader[path + '\n' + defines];
 
 	if (ret != 0) {
 		// shader exists. verify that it is of the right type
@@ -57,21 +66,29 @@ GLuint get_shader (const std::string& path, GLenum type)
 		return ret;
 	}
 
-	ret = compile_glsl(PATH_SHADER + path, type);
+	ret = compile_glsl(PATH_SHADER + path, type, defines);
 
 	if (!ret)
 		fatal("Cannot load shader %s", path.c_str());
 	return ret;
 }
 
-GLuint get_vert_shader (const std::string& name)
+GLuint get_vert_shader (const std::string& name,
+		const std::string& defines)
+{
+	return get_shader(name + ".vert", GL_VERTEX_SHADER, defines);
+}
+
+GLuint get_geom_shader (const std::string& name,
+		const std::string& defines)
 {
-	return get_shader(name + ".vert", GL_VERTEX_SHADER);
+	return get_shader(name + ".geom", GL_GEOMETRY_SHADER, defines);
 }
 
-GLuint get_frag_shader (const std::string& name)
+GLuint get_frag_shader (const std::string& name,
+		const std::string& defines)
 {
-	return get_shader(name + ".frag", GL_FRAGMENT_SHADER);
+	return get_shader(name + ".frag", GL_FRAGMENT_SHADER, defines);
 }
 
 t_material* get_material (std::string path)
@@ -16,12 +16,24 @@ const char* const PATH_MATERIAL = "res/mat/";
 const char* const PATH_SHADER = "res/shader/";
 
 t_model* get_model (std::string name);
+/* Read a model into memory, not caching it; for baking it elsewhere */
+void load_model_mem (const std::string& name, t_model_mem& dest);
 GLuint get_texture (std::string name);
 t_material* get_material (std::string name);
 
-GLuint get_frag_shader (const std::string& name);
-GLuint get_vert_shader (const std::string& name);
-GLuint get_shader (const std::string& name, GLenum type);
+/*
+ * defines are "#define ..." lines which are put into the
+ *   source right after its #version; see compile_glsl().
+ * The render settings (render/settings.h) are always defined
+ */
+GLuint get_frag_shader (const std::string& name,
+		const std::string& defines = "");
+GLuint get_vert_shader (const std::string& name,
+		const std::string& defines = "");
+GLuint get_geom_shader (const std::string& name,
+		const std::string& defines = "");
+GLuint get_shader (const std::string& name, GLenum type,
+		const std::string& defines = "");
 
 /*
  * Declare these because some initializers may want to
@@ -0,0 +1,107 @@
+#include "inc_gl.h"
+#include "input/cmds.h"
+#include "render/settings.h"
+#include "render/impostor.h"
+#include "render/visbuf.h"
+#include "render/vis.h"
+#include "render/light/cone.h"
+#include "render/light/sun.h"
+#include <cctype>
+#include <iostream>
+#include <sstream>
+
+int sun_num_cascades = 3;
+int sun_lspace_resolution = 2048;
+int cone_lspace_resolution = 1024;
+int cone_atlas_slots = 8;
+int occ_fbo_size = 256;
+
+static const struct {
+	const char* name;
+	int* value;
+	int min;
+	int max;
+
+	/* Bring whatever depends on the setting up to date */
+	void (*realloc) ();
+
+	bool power_of_two = false;
+} settings[] = {
+	// the uniform arrays in sun.frag have room for no more than that
+	{ "sun_num_cascades", &sun_num_cascades,
+		1, MAX_RENDER_LAYERS, realloc_lighting_sun },
+	{ "sun_lspace_resolution", &sun_lspace_resolution,
+		64, 8192, realloc_lighting_sun },
+	{ "cone_lspace_resolution", &cone_lspace_resolution,
+		64, 8192, realloc_lighting_cone },
+	// so many lights go into a clustered pass, see light/cone.cpp
+	{ "cone_atlas_slots", &cone_atlas_slots,
+		1, MAX_CONE_ATLAS_SLOTS, realloc_lighting_cone },
+	// each level of the Hi-Z buffer takes in 2x2 of the one before
+	{ "occ_fbo_size", &occ_fbo_size,
+		16, 4096, realloc_vis, true },
+};
+
+/* The fixed ones, which the shaders see by the same names */
+static const struct {
+	const char* name;
+	int value;
+} constants[] = {
+	{ "MAX_RENDER_LAYERS", MAX_RENDER_LAYERS },
+	{ "IMPOSTOR_VIEWS", IMPOSTOR_VIEWS },
+	{ "VISBUF_TRIANGLE_BITS", VISBUF_TRIANGLE_BITS },
+	{ "VISBUF_DRAW_TEXELS", VISBUF_DRAW_TEXELS },
+	{ "VISBUF_TILE_SIZE", VISBUF_TILE_SIZE },
+	{ "MAX_VISBUF_GROUPS", MAX_VISBUF_GROUPS },
+};
+
+std::string render_settings_defines ()
+{
+	std::ostringstream s;
+
+	for (const auto& st: settings) {
+		std::string name = st.name;
+		for (char& c: name)
+			c = std::toupper(c);
+		s << "#define " << name << ' ' << *st.value << '\n';
+	}
+
+	for (const auto& c: constants)
+		s << "#define " << c.name << ' ' << c.value << '\n';
+
+	return s.str();
+}
+
+/* No arguments lists all, one prints it, two sets it */
+COMMAND_ROUTINE (render_setting)
+{
+	if (ev != PRESS)
+		return;
+
+	for (const auto& st: settings) {
+		if (!args.empty() && args[0] != st.name)
+			continue;
+
+		if (args.size() < 2) {
+			std::cout << st.name << ' ' << *st.value << std::endl;
+			continue;
+		}
+
+		int v = atoi(args[1].c_str());
+		if (v < st.min || v > st.max) {
+			warning("%s must be within %i and %i",
+				st.name, st.min, st.max);
+			return;
+		}
+		if (st.power_of_two && (v & (v - 1)) != 0) {
+			warning("%s must be a power of two", st.name);
+			return;
+		}
+
+		if (v != *st.value) {
+			*st.value = v;
+			st.realloc();
+		}
+		return;
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef RENDER_SETTINGS_H
+#define RENDER_SETTINGS_H
+
+#include <string>
+
+/*
+ * Render constants that the shaders depend on too, kept in one place.
+ * Every shader sees each of them as a #define of its name in capitals
+ *   (SUN_NUM_CASCADES etc.), see render_settings_defines().
+ * They can be changed at runtime with `render_setting <name> <value>`,
+ *   which reallocates the framebuffers and recompiles the programs
+ *   that depend on the one changed.
+ * The fixed constants which the shaders need (MAX_RENDER_LAYERS etc.)
+ *   get #defined along with them, by the same names
+ */
+extern int sun_num_cascades;
+extern int sun_lspace_resolution;
+extern int cone_lspace_resolution;
+extern int cone_atlas_slots;
+extern int occ_fbo_size;
+
+/* The #define lines for all of the above */
+std::string render_settings_defines ();
+
+#endif // RENDER_SETTINGS_H
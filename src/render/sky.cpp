@@ -19,7 +19,7 @@ void render_sky ()
 	render_ctx.submit_viewproj();
 
 	glDisable(GL_DEPTH_TEST);
-	glCallList(cuboid_dlist_inwards);
+	cuboid_inwards.draw();
 	glEnable(GL_DEPTH_TEST);
 }
 
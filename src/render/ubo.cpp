@@ -0,0 +1,139 @@
+#include "render/ubo.h"
+#include <cstring>
+
+static_assert(sizeof(t_frame_uniforms) == 208);
+static_assert(sizeof(t_pass_uniforms) == 128);
+static_assert(sizeof(t_draw_uniforms) == 64);
+
+static GLuint frame_ubo;
+
+/*
+ * The ring has a section per frame in flight. A section only gets
+ *   written to again once the fence after its frame has passed
+ */
+constexpr int ring_sections = 3;
+constexpr GLsizeiptr ring_section_size = 4 << 20;
+
+static GLuint ring;
+static uint8_t* ring_ptr;
+static GLint ring_align;
+
+static GLsync section_fence[ring_sections];
+static int section = 0;
+static GLsizeiptr head = 0;
+
+static t_pass_uniforms latest_pass;
+static bool latest_pass_valid = false;
+
+void init_uniform_buffers ()
+{
+	glCreateBuffers(1, &frame_ubo);
+	glNamedBufferStorage(frame_ubo, sizeof(t_frame_uniforms),
+			nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UBO_BINDING_FRAME, frame_ubo);
+
+	GLbitfield flags = GL_MAP_WRITE_BIT
+	                 | GL_MAP_PERSISTENT_BIT
+	                 | GL_MAP_COHERENT_BIT;
+	GLsizeiptr size = ring_sections * ring_section_size;
+
+	glCreateBuffers(1, &ring);
+	glNamedBufferStorage(ring, size, nullptr, flags);
+	ring_ptr = (uint8_t*) glMapNamedBufferRange(ring, 0, size, flags);
+	if (ring_ptr == nullptr)
+		fatal("Cannot map the uniform ring buffer");
+
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ring_align);
+}
+
+void uniforms_begin_frame (const t_frame_uniforms& f)
+{
+	glNamedBufferSubData(frame_ubo, 0, sizeof(f), &f);
+
+	section = (section + 1) % ring_sections;
+	head = section * ring_section_size;
+	latest_pass_valid = false;
+
+	GLsync& fence = section_fence[section];
+	if (fence == nullptr)
+		return;
+
+	constexpr GLuint64 timeout = 1'000'000; // ns
+	while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout)
+			== GL_TIMEOUT_EXPIRED)
+		continue;
+
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+
+void uniforms_end_frame ()
+{
+	section_fence[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static GLsizeiptr ring_alloc (GLsizeiptr size)
+{
+	head = (head + ring_align - 1) / ring_align * ring_align;
+
+	if (head + size > (section + 1) * ring_section_size) {
+		// more draws in a frame than the section has room for:
+		// wait until what is there gets used, and go over it again
+		static bool warned = false;
+		if (!warned) {
+			warning("Uniform ring section of %li bytes overflown",
+				(long) ring_section_size);
+			warned = true;
+		}
+
+		glFinish();
+		head = section * ring_section_size;
+		latest_pass_valid = false;
+	}
+
+	GLsizeiptr ret = head;
+	head += size;
+	return ret;
+}
+
+static void ring_submit (GLuint binding, const void* data, GLsizeiptr size)
+{
+	GLsizeiptr offset = ring_alloc(size);
+	std::memcpy(ring_ptr + offset, data, size);
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, ring, offset, size);
+}
+
+void uniforms_submit_pass (const t_pass_uniforms& p)
+{
+	if (latest_pass_valid && latest_pass.proj == p.proj
+	&& latest_pass.view == p.view)
+		return;
+
+	ring_submit(UBO_BINDING_PASS, &p, sizeof(p));
+	latest_pass = p;
+	latest_pass_valid = true;
+}
+
+void uniforms_submit_draw (const t_draw_uniforms& d)
+{
+	ring_submit(UBO_BINDING_DRAW, &d, sizeof(d));
+}
+
+void uniforms_bind_blocks (GLuint program)
+{
+	static const struct {
+		const char* name;
+		GLuint binding;
+	} blocks[] = {
+		{ "frame_uniforms", UBO_BINDING_FRAME },
+		{ "pass_uniforms", UBO_BINDING_PASS },
+		{ "draw_uniforms", UBO_BINDING_DRAW },
+		{ "cone_lights", UBO_BINDING_CONE_LIGHTS },
+	};
+
+	for (const auto& b: blocks) {
+		GLuint idx = glGetUniformBlockIndex(program, b.name);
+		if (idx != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, idx, b.binding);
+	}
+}
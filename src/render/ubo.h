@@ -0,0 +1,56 @@
+#ifndef UBO_H
+#define UBO_H
+
+#include "inc_gl.h"
+#include "misc.h"
+
+/*
+ * The uniform blocks which programs get from internal/_uniforms.inc.
+ * These are std140 and must match the GLSL declarations exactly!
+ *
+ * The frame block is the camera, written once a frame. The pass block
+ *   has the matrices of whatever is being rendered from at the moment,
+ *   be it the camera or a light, and the draw block is per draw.
+ * Pass and draw blocks are streamed into a persistently mapped ring,
+ *   so that a draw only costs a copy and a glBindBufferRange
+ */
+struct t_frame_uniforms
+{
+	mat4 camera_proj;
+	mat4 camera_view;
+	vec4 camera_pos;
+	/* For getting positions back from the depth buffer */
+	mat4 camera_inv_viewproj;
+};
+
+struct t_pass_uniforms
+{
+	mat4 proj;
+	mat4 view;
+};
+
+struct t_draw_uniforms
+{
+	mat4 model;
+};
+
+void init_uniform_buffers ();
+
+/*
+ * Write the frame block, and start on the part of the ring which the
+ *   GPU has finished reading, as fenced off at the end of a frame
+ */
+void uniforms_begin_frame (const t_frame_uniforms& f);
+void uniforms_end_frame ();
+
+/*
+ * Write the block into the ring and bind it to its binding point.
+ * A pass block same as the latest one is not written again
+ */
+void uniforms_submit_pass (const t_pass_uniforms& p);
+void uniforms_submit_draw (const t_draw_uniforms& d);
+
+/* Have the program's blocks use their binding points; after linking */
+void uniforms_bind_blocks (GLuint program);
+
+#endif // UBO_H
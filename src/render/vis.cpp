@@ -3,18 +3,26 @@
 #include "render/framebuffer.h"
 #include "render/material.h"
 #include "render/resource.h"
+#include "render/instancing.h"
+#include "render/impostor.h"
+#include "render/settings.h"
 #include "render/vis.h"
+#include "render/pvs.h"
+#include "render/light/cone.h"
+#include "render/light/sun.h"
 #include <algorithm>
+#include <cassert>
 #include <cstring>
+#include <iostream>
+#include <unordered_map>
 
 oct_node* root = nullptr;
 t_visible_set all_leaves;
 
-constexpr int occ_fbo_size = 256;
 t_fbo occ_fbo;
 
 static GLuint occ_planes_prog;
-static GLuint occ_planes_dlist;
+static t_simple_vao occ_planes_vao;
 static GLuint occ_cube_prog;
 
 
@@ -24,6 +32,32 @@ COMMAND_SET_BOOL (vis_disable, pass_all_nodes);
 
 int oct_leaf_capacity = 0;
 int oct_max_depth = 0;
+int oct_cluster_size = 0;
+
+static bool entity_occlusion = true;
+COMMAND_SET_BOOL (vis_entity_occlusion, entity_occlusion);
+
+/* At most so many tiles across, for t_visible_set::occ_tiles */
+constexpr int OCC_TILES = 64;
+
+bool vis_cluster_culling = true;
+COMMAND_SET_BOOL (vis_cluster_cull, vis_cluster_culling);
+
+/* The radii in pixels below which things get culled; 0 for never */
+static float contrib_px = 0.5;
+static float contrib_shadow_px = 1.0;
+
+COMMAND_ROUTINE (vis_contrib_px)
+{
+	if (ev == PRESS && !args.empty())
+		contrib_px = atof(args[0].c_str());
+}
+
+COMMAND_ROUTINE (vis_contrib_shadow_px)
+{
+	if (ev == PRESS && !args.empty())
+		contrib_shadow_px = atof(args[0].c_str());
+}
 
 
 void init_vis ()
@@ -36,15 +70,41 @@ void init_vis ()
 		{ get_vert_shader("internal/vis_cuboid"),
 		  get_frag_shader("common/null") });
 
+	occ_planes_vao.make({ { ATTRIB_LOC_POSITION, 3 } });
+
+	init_vis_gpu();
+	realloc_vis();
+}
+
+void realloc_vis ()
+{
+	if (occ_fbo.depth.taken()) {
+		attachment_free(occ_fbo.depth.ptr);
+		occ_fbo.destroy();
+	}
+
+	// a texture, for the Hi-Z buffer to be made out of
 	occ_fbo.make()
-		.attach_depth(make_rbo(
-			occ_fbo_size, occ_fbo_size, GL_DEPTH_COMPONENT))
+		.attach_depth(make_tex2d(
+			occ_fbo_size, occ_fbo_size, GL_DEPTH_COMPONENT24))
 		.assert_complete();
+
+	vis_gpu_realloc();
 }
 
 
 static t_bound_box world_bounds_override;
-static t_model_mem world;
+static std::string world_path;
+
+// along with root, the PVS bake casts rays against it
+t_model_mem world;
+
+/*
+ * All of the world's triangles are in one mesh, ordered by leaf and
+ *   then by material, so each leaf bucket is a range of its indices
+ */
+static t_mesh world_mesh;
+static std::vector<uint32_t> world_indices;
 
 /*
  * The ID of the octant in which point is
@@ -78,9 +138,11 @@ void oct_node::build (t_bound_box b, int level)
 			b.expand(world.get_vertex(d, i).pos);
 	}
 	bounds = b;
+	first_leaf = all_leaves.leaves.size();
 
 	if (level >= oct_max_depth || bucket.size() <= oct_leaf_capacity) {
 		make_leaf();
+		end_leaf = first_leaf + 1;
 		return;
 	}
 
@@ -100,6 +162,82 @@ void oct_node::build (t_bound_box b, int level)
 
 	for (int i = 0; i < 8; i++)
 		children[i].build(octant_bound(bounds, i), level + 1);
+	end_leaf = all_leaves.leaves.size();
+}
+
+static vec3 triangle_normal (int tri)
+{
+	const vec3& a = world.get_vertex(tri, 0).pos;
+	const vec3& b = world.get_vertex(tri, 1).pos;
+	const vec3& c = world.get_vertex(tri, 2).pos;
+
+	vec3 n = glm::cross(b - a, c - a);
+	float len = glm::length(n);
+	return len > 0.0 ? n / len : vec3(0.0);
+}
+
+/* Which of the six axis directions the triangle faces the most */
+static int facing_bin (int tri)
+{
+	vec3 n = triangle_normal(tri);
+	vec3 a = glm::abs(n);
+	int axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+	return 2 * axis + (n[axis] < 0.0);
+}
+
+/*
+ * The cone as in oct_node::mat_group. The apex is put behind every
+ *   triangle's plane, so that seeing it from the back of all of them
+ *   (the cutoff) means seeing the triangles from the back too
+ */
+static void bound_normals (oct_node::mat_group& g, const int* tris, int n)
+{
+	g.cone_apex = vec3(0.0);
+	g.cone_axis = vec3(0.0, 0.0, 1.0);
+	g.cone_cutoff = 2.0;
+
+	vec3 sum(0.0);
+	t_bound_box b = { vec3(INFINITY), vec3(-INFINITY) };
+	for (int i = 0; i < n; i++) {
+		sum += triangle_normal(tris[i]);
+		for (int j = 0; j < 3; j++)
+			b.expand(world.get_vertex(tris[i], j).pos);
+	}
+	if (glm::length(sum) == 0.0)
+		return;
+	vec3 axis = glm::normalize(sum);
+
+	float min_dot = 1.0;
+	for (int i = 0; i < n; i++) {
+		vec3 nm = triangle_normal(tris[i]);
+		// degenerate ones never get drawn anyway
+		if (nm != vec3(0.0))
+			min_dot = std::min(min_dot, glm::dot(nm, axis));
+	}
+	if (min_dot <= 0.0)
+		return;
+
+	vec3 mid = (b.start + b.end) * 0.5f;
+	float behind = 0.0;
+	for (int i = 0; i < n; i++) {
+		vec3 nm = triangle_normal(tris[i]);
+		if (nm == vec3(0.0))
+			continue;
+		const vec3& p = world.get_vertex(tris[i], 0).pos;
+		behind = std::max(behind,
+			glm::dot(nm, mid - p) / glm::dot(nm, axis));
+	}
+
+	g.cone_apex = mid - axis * behind;
+	g.cone_axis = axis;
+	g.cone_cutoff = std::sqrt(1.0 - min_dot * min_dot);
+}
+
+bool oct_node::mat_group::faces_away (const vec4& eye) const
+{
+	vec3 to_apex = cone_apex * eye.w - vec3(eye);
+	return glm::dot(to_apex, cone_axis)
+	     > cone_cutoff * glm::length(to_apex);
 }
 
 void oct_node::make_leaf ()
@@ -112,16 +250,42 @@ void oct_node::make_leaf ()
 
 	mat_buckets.reserve(m.size());
 
-	for (const auto& [mat, tri_ids]: m) {
-		unsigned int dlist = glGenLists(1);
-		glNewList(dlist, GL_COMPILE);
-		glBegin(GL_TRIANGLES);
-		for (int i: tri_ids)
-			world.gl_send_triangle(i);
-		glEnd();
-		glEndList();
+	for (auto& [mat, tri_ids]: m) {
+		int size = oct_cluster_size > 0 ? oct_cluster_size
+		                                : tri_ids.size();
 
-		mat_buckets.push_back({ mat, dlist });
+		// so that a cluster's triangles face about the same way
+		if (oct_cluster_size > 0) {
+			std::stable_sort(tri_ids.begin(), tri_ids.end(),
+				[] (int a, int b) {
+					return facing_bin(a) < facing_bin(b);
+				});
+		}
+
+		for (int start = 0; start < tri_ids.size(); start += size) {
+			int end = std::min(start + size, (int) tri_ids.size());
+
+			int first = world_indices.size();
+			for (int i = start; i < end; i++) {
+				for (int j = 0; j < 3; j++)
+					world_indices.push_back(world.triangles[
+						tri_ids[i]].index[j]);
+			}
+
+			mat_group g;
+			g.mat = mat;
+			g.first = first;
+			g.count = 3 * (end - start);
+			bound_normals(g, tri_ids.data() + start, end - start);
+
+			g.bounds = { vec3(INFINITY), vec3(-INFINITY) };
+			for (int i = start; i < end; i++) {
+				for (int j = 0; j < 3; j++)
+					g.bounds.expand(world.get_vertex(
+						tri_ids[i], j).pos);
+			}
+			mat_buckets.push_back(g);
+		}
 	}
 }
 
@@ -139,14 +303,105 @@ oct_node::~oct_node ()
 }
 
 
+/*
+ * The occlusion depth gets read into the set's pixel buffer, and taken
+ *   up by a later fill() (or take_occ_readback()) once the GPU is done
+ *   with it, so that nothing waits on the other. In the GPU driven
+ *   mode that is a level of the Hi-Z buffer, which is the farthest of
+ *   each tile already
+ */
+static void start_occ_readback (t_visible_set& s)
+{
+	if (s.occ_fence != nullptr)
+		return;
+
+	int size = occ_fbo_size;
+	if (s.occ_pbo == 0)
+		glCreateBuffers(1, &s.occ_pbo);
+	glNamedBufferData(s.occ_pbo, size * size * sizeof(float), nullptr,
+			GL_STREAM_READ);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, s.occ_pbo);
+	if (vis_gpu_driven) {
+		s.occ_pending_size = vis_gpu_read_hiz(OCC_TILES);
+		s.occ_pending_reduced = true;
+	} else {
+		glReadPixels(0, 0, size, size, GL_DEPTH_COMPONENT, GL_FLOAT,
+				nullptr);
+		s.occ_pending_size = size;
+		s.occ_pending_reduced = false;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	s.occ_pending_clip = s.clip_from_world;
+	s.occ_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void t_visible_set::take_occ_readback ()
+{
+	if (occ_fence == nullptr)
+		return;
+
+	GLenum status = glClientWaitSync(occ_fence, 0, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return;
+	glDeleteSync(occ_fence);
+	occ_fence = nullptr;
+
+	int size = occ_pending_size;
+	const float* depth = (const float*) glMapNamedBufferRange(occ_pbo,
+			0, size * size * sizeof(float), GL_MAP_READ_BIT);
+	if (depth == nullptr)
+		return;
+
+	// keeping the farthest of each tile
+	int tile = occ_pending_reduced ? 1
+		: (size + OCC_TILES - 1) / OCC_TILES;
+	int n = (size + tile - 1) / tile;
+
+	occ_tiles.assign(n * n, 0.0);
+	occ_tiles_size = n;
+	occ_tiles_clip = occ_pending_clip;
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			float& t = occ_tiles[(y / tile) * n + x / tile];
+			t = std::max(t, depth[y * size + x]);
+		}
+	}
+
+	glUnmapNamedBuffer(occ_pbo);
+}
+
+void t_visible_set::free_occ_readback ()
+{
+	if (occ_fence != nullptr)
+		glDeleteSync(occ_fence);
+	if (occ_pbo != 0)
+		glDeleteBuffers(1, &occ_pbo);
+	occ_fence = nullptr;
+	occ_pbo = 0;
+	occ_tiles.clear();
+}
+
 void t_visible_set::fill ()
 {
+	layers.clear();
+	clip_from_world = render_ctx.proj * render_ctx.view;
+	hiz_id = 0;
+	cull_eye = vec4(render_ctx.eye_pos, 1.0);
+	if (!entity_occlusion)
+		free_occ_readback();
+
 	if (pass_all_nodes) {
 		leaves = all_leaves.leaves;
 		return;
 	}
 	leaves.clear();
 
+	// as the map's entities load, before the octree is built
+	if (root == nullptr)
+		return;
+
 	occ_fbo.apply();
 	glClear(GL_DEPTH_BUFFER_BIT);
 
@@ -157,7 +412,21 @@ void t_visible_set::fill ()
 
 	glUseProgram(occ_planes_prog);
 	render_ctx.submit_viewproj();
-	glCallList(occ_planes_dlist);
+	occ_planes_vao.draw();
+
+	if (entity_occlusion)
+		take_occ_readback();
+
+	if (vis_gpu_driven) {
+		hiz_id = vis_gpu_build_hiz();
+		if (entity_occlusion)
+			start_occ_readback(*this);
+		glEnable(GL_CULL_FACE);
+		return;
+	}
+
+	if (entity_occlusion)
+		start_occ_readback(*this);
 
 	// attempt to draw the octree's cuboids
 	glUseProgram(occ_cube_prog);
@@ -168,6 +437,7 @@ void t_visible_set::fill ()
 	// BFS, but exploit the fact that a tree is bipartite,
 	// parts being the even and odd depths
 	std::vector<oct_node*> queues[2] = { { root }, { } };
+	const vec3& eye = render_ctx.eye_pos;
 	int cur_queue = 0;
 
 	while (!queues[cur_queue].empty()) {
@@ -179,12 +449,16 @@ void t_visible_set::fill ()
 				continue;
 			}
 			for (int i = 0; i < 8; i++) {
+				const oct_node& c = n->children[i];
+				if (!pvs_may_see(eye, c.first_leaf, c.end_leaf))
+					continue;
+
 				glBeginQuery(GL_SAMPLES_PASSED,
 						n->children[i].query);
 
 				glUniform3fv(UNIFORM_LOC_VIS_CUBE, 2,
 					n->children[i].bounds.data());
-				glCallList(cuboid_dlist_outwards);
+				cuboid_outwards.draw();
 
 				glEndQuery(GL_SAMPLES_PASSED);
 			}
@@ -195,11 +469,15 @@ void t_visible_set::fill ()
 			if (!c)
 				continue;
 			for (; c < n->children + 8; c++) {
+				// never queried, see above
+				if (!pvs_may_see(eye, c->first_leaf, c->end_leaf))
+					continue;
+
 				unsigned int pixels;
 				glGetQueryObjectuiv(c->query,
 						GL_QUERY_RESULT, &pixels);
 				if (pixels > 0
-				|| c->bounds.point_in(render_ctx.eye_pos, 1.5))
+				|| c->bounds.point_in(eye, 1.5))
 					queues[cur_queue ^ 1].push_back(c);
 			}
 		}
@@ -212,6 +490,308 @@ void t_visible_set::fill ()
 }
 
 
+bool t_cull_box::intersects (const t_bound_box& b) const
+{
+	return box.intersects(b.transformed(to_box_space));
+}
+
+/* Where the segment from a to a + d hits the triangle, or -1 */
+static float segment_hits (const vec3& a, const vec3& d, int tri)
+{
+	const vec3& p0 = world.get_vertex(tri, 0).pos;
+	const vec3& p1 = world.get_vertex(tri, 1).pos;
+	const vec3& p2 = world.get_vertex(tri, 2).pos;
+
+	vec3 e1 = p1 - p0;
+	vec3 e2 = p2 - p0;
+	vec3 p = glm::cross(d, e2);
+	float det = glm::dot(e1, p);
+	if (std::abs(det) < 1e-12)
+		return -1.0;
+
+	vec3 s = a - p0;
+	float u = glm::dot(s, p) / det;
+	if (u < 0.0 || u > 1.0)
+		return -1.0;
+
+	vec3 q = glm::cross(s, e1);
+	float v = glm::dot(d, q) / det;
+	if (v < 0.0 || u + v > 1.0)
+		return -1.0;
+
+	return glm::dot(e2, q) / det;
+}
+
+/* The slab test, for the segment from a to a + d */
+static bool segment_in_box (const vec3& a, const vec3& d,
+		const t_bound_box& b)
+{
+	float t0 = 0.0;
+	float t1 = 1.0;
+	for (int i = 0; i < 3; i++) {
+		if (std::abs(d[i]) < 1e-12) {
+			if (a[i] < b.start[i] || a[i] > b.end[i])
+				return false;
+			continue;
+		}
+		float ta = (b.start[i] - a[i]) / d[i];
+		float tb = (b.end[i] - a[i]) / d[i];
+		t0 = std::max(t0, std::min(ta, tb));
+		t1 = std::min(t1, std::max(ta, tb));
+		if (t0 > t1)
+			return false;
+	}
+	return true;
+}
+
+int vis_segment_hit (const vec3& a, const vec3& b, float skip, float* t)
+{
+	vec3 d = b - a;
+	float len = glm::length(d);
+	if (len == 0.0 || root == nullptr)
+		return -1;
+
+	float t_min = skip / len;
+	float nearest = 1.0 - t_min;
+	int hit = -1;
+
+	std::vector<const oct_node*> stack = { root };
+	while (!stack.empty()) {
+		const oct_node* n = stack.back();
+		stack.pop_back();
+
+		if (!segment_in_box(a, d, n->bounds))
+			continue;
+
+		if (n->children) {
+			for (int i = 0; i < 8; i++)
+				stack.push_back(n->children + i);
+			continue;
+		}
+
+		for (int tri: n->bucket) {
+			float th = segment_hits(a, d, tri);
+			if (th <= t_min || th >= nearest)
+				continue;
+			if (t == nullptr)
+				return tri;
+			nearest = th;
+			hit = tri;
+		}
+	}
+
+	if (t != nullptr)
+		*t = nearest;
+	return hit;
+}
+
+static void add_leaves_in_box (std::vector<const oct_node*>& leaves,
+		const oct_node* n, const t_cull_box& cb)
+{
+	if (!cb.intersects(n->bounds))
+		return;
+
+	if (!n->children) {
+		leaves.push_back(n);
+		return;
+	}
+
+	for (int i = 0; i < 8; i++)
+		add_leaves_in_box(leaves, n->children + i, cb);
+}
+
+void t_visible_set::fill_cull_box (const t_cull_box& cb, vec4 eye)
+{
+	layers.clear();
+	clip_from_world = vis_cull_box_clip(cb);
+	hiz_id = 0;
+	cull_eye = eye;
+	occ_tiles.clear();
+
+	if (pass_all_nodes) {
+		leaves = all_leaves.leaves;
+		cull_entities = false;
+		return;
+	}
+
+	leaves.clear();
+	cull_entities = true;
+	entity_cull = cb;
+
+	if (!vis_gpu_driven && root != nullptr)
+		add_leaves_in_box(leaves, root, cb);
+}
+
+void t_visible_set::fill_layered (const std::vector<const t_visible_set*>& s)
+{
+	assert(s.size() <= MAX_RENDER_LAYERS);
+
+	leaves.clear();
+	leaf_layer_masks.clear();
+	layers = s;
+	cull_entities = false;
+	hiz_id = 0;
+	cull_eye = vec4(0.0);
+	occ_tiles.clear();
+
+	// the layers' matrices are all that the GPU needs
+	if (vis_gpu_driven)
+		return;
+
+	std::unordered_map<const oct_node*, int> index;
+
+	for (int i = 0; i < s.size(); i++) {
+		if (s[i] == nullptr)
+			continue;
+		for (const oct_node* l: s[i]->leaves) {
+			auto [iter, inserted] = index.try_emplace(
+					l, leaves.size());
+			if (inserted) {
+				leaves.push_back(l);
+				leaf_layer_masks.push_back(0);
+			}
+			leaf_layer_masks[iter->second] |= 1u << i;
+		}
+	}
+}
+
+bool t_visible_set::occluded (const t_bound_box& b) const
+{
+	if (occ_tiles.empty())
+		return false;
+	if (!occ_any_view && occ_tiles_clip != clip_from_world)
+		return false;
+
+	vec3 lo = vec3(1.0);
+	vec3 hi = vec3(-1.0);
+	for (int i = 0; i < 8; i++) {
+		vec3 p = { (i & 1 ? b.end : b.start).x,
+		           (i & 2 ? b.end : b.start).y,
+		           (i & 4 ? b.end : b.start).z };
+		vec4 c = occ_tiles_clip * vec4(p, 1.0);
+
+		// reaching behind the eye: too close to tell
+		if (c.w <= 0.0)
+			return false;
+		lo = glm::min(lo, vec3(c) / c.w);
+		hi = glm::max(hi, vec3(c) / c.w);
+	}
+
+	int n = occ_tiles_size;
+	auto tile = [n] (float ndc) -> int {
+		return glm::clamp((int) ((ndc * 0.5f + 0.5f) * n), 0, n - 1);
+	};
+
+	float nearest = lo.z * 0.5f + 0.5f;
+	for (int y = tile(lo.y); y <= tile(hi.y); y++) {
+		for (int x = tile(lo.x); x <= tile(hi.x); x++) {
+			if (occ_tiles[y * n + x] >= nearest)
+				return false;
+		}
+	}
+	return true;
+}
+
+void t_visible_set::set_contribution (float ppu, bool shadow, vec3 origin)
+{
+	pixels_per_unit = ppu;
+	shadow_view = shadow;
+	dist_origin = origin;
+}
+
+float t_visible_set::min_size_ratio () const
+{
+	float threshold = shadow_view ? contrib_shadow_px : contrib_px;
+	if (pixels_per_unit <= 0.0 || threshold <= 0.0)
+		return 0.0;
+	return threshold / pixels_per_unit;
+}
+
+/* Has to match contributes() in internal/vis_cull.comp */
+bool t_visible_set::contributes (const t_bound_box& b) const
+{
+	float min_size = min_size_ratio();
+	if (min_size <= 0.0)
+		return true;
+
+	vec3 mid = (b.start + b.end) * 0.5f;
+	float radius = glm::length(b.end - b.start) * 0.5f;
+
+	if (cull_eye.w != 0.0) {
+		float dist = glm::distance(vec3(cull_eye) / cull_eye.w, mid);
+		// the eye is inside it
+		if (dist <= radius)
+			return true;
+		return radius >= min_size * dist;
+	}
+	return radius >= min_size;
+}
+
+bool t_visible_set::entity_contributes (const e_base* e) const
+{
+	t_bound_box b = e->get_bbox();
+
+	float max_dist = e->draw_dist(shadow_view);
+	if (max_dist > 0.0) {
+		vec3 nearest = glm::clamp(dist_origin, b.start, b.end);
+		if (glm::distance(nearest, dist_origin) > max_dist)
+			return false;
+	}
+	return contributes(b);
+}
+
+/* The layers of a layered set in which the entity is to be drawn */
+static uint32_t entity_layer_mask (const t_visible_set& s, const e_base* e)
+{
+	t_bound_box b = e->get_bbox();
+	uint32_t r = 0;
+
+	for (int i = 0; i < s.layers.size(); i++) {
+		if (s.layers[i] == nullptr)
+			continue;
+		const t_visible_set& l = *s.layers[i];
+		if (l.cull_entities && !l.entity_cull.intersects(b))
+			continue;
+		if (!l.entity_contributes(e))
+			continue;
+
+		r |= 1u << i;
+		l.num_entities_rendered++;
+	}
+	return r;
+}
+
+/*
+ * Of the layers in the mask, those whose views may see some of the
+ *   bucket, counting it in the stats if that is none
+ */
+static uint32_t bucket_layer_mask (const oct_node::mat_group& gr,
+		const t_visible_set* const* views, uint32_t mask,
+		bool cull_clusters)
+{
+	uint32_t facing = mask;
+	if (cull_clusters) {
+		for (int i = 0; i < MAX_RENDER_LAYERS; i++) {
+			if ((mask & (1u << i)) && gr.faces_away(views[i]->cull_eye))
+				facing &= ~(1u << i);
+		}
+		if (facing == 0) {
+			frame_stats.clusters_culled++;
+			return 0;
+		}
+	}
+
+	uint32_t r = 0;
+	for (int i = 0; i < MAX_RENDER_LAYERS; i++) {
+		if ((facing & (1u << i)) && views[i]->contributes(gr.bounds))
+			r |= 1u << i;
+	}
+	if (r == 0)
+		frame_stats.contrib_culled++;
+	return r;
+}
+
+
 
 void oct_node::requery_entity (e_base* e, const t_bound_box& b)
 {
@@ -247,38 +827,183 @@ void oct_node::requery_entity (e_base* e, const t_bound_box& b)
 
 void vis_requery_entity (e_base* e)
 {
+	// entities loaded with the map go in at vis_finish_world()
+	if (root == nullptr || e->in_world_geometry())
+		return;
 	root->requery_entity(e, e->get_bbox());
 }
 
 
+/*
+ * When we walk the entities in the leaves like this, there
+ *   is redundancy (multiple leaves that we see will touch
+ *   the same entity), so we need to ensure each entity is
+ *   drawn once.
+ * So, define a guard key that is unique for each invocation
+ *   and use it to determine if we have already
+ *   seen any particular entity in this invocation
+ */
+static uint64_t guard_key = 0;
+
+void t_visible_set::entities_in_view (std::vector<e_base*>& out) const
+{
+	guard_key++;
+
+	// the sets culling entities by a box test them by that
+	bool test_nodes = filled_for_view();
+
+	std::vector<const oct_node*> stack;
+	if (root != nullptr)
+		stack.push_back(root);
+	while (!stack.empty()) {
+		const oct_node* n = stack.back();
+		stack.pop_back();
+
+		if (cull_entities && !entity_cull.intersects(n->bounds))
+			continue;
+		if (test_nodes
+		 && (!vis_box_in_clip(clip_from_world, n->bounds)
+		  || !pvs_may_see(vec3(cull_eye), n->first_leaf, n->end_leaf)))
+			continue;
+
+		if (n->children) {
+			for (int i = 0; i < 8; i++)
+				stack.push_back(n->children + i);
+			continue;
+		}
+
+		for (e_base* e: n->entities_inside) {
+			if (e->render_last_guard_key == guard_key)
+				continue;
+			e->render_last_guard_key = guard_key;
+			out.push_back(e);
+		}
+	}
+}
+
 void t_visible_set::render () const
 {
-	/*
-	 * When we walk the entities in the leaves like this, there
-	 *   is redundancy (multiple leaves that we see will touch
-	 *   the same entity), so we need to ensure each entity is
-	 *   drawn once.
-	 * So, define a guard key that is unique for each invocation
-	 *   and use it to determine if we have already
-	 *   seen any particular entity in this invocation
-	 */
-	static uint64_t guard_key = 0;
 	guard_key++;
 
-	for (const oct_node* l: leaves) {
+	num_entities_rendered = 0;
+	num_entities_outside = 0;
+	num_entities_occluded = 0;
+	for (const t_visible_set* s: layers) {
+		if (s != nullptr)
+			s->num_entities_rendered = 0;
+	}
+
+	bool layered = !layers.empty();
+
+	// the sets culling entities by a box have tested them already
+	bool test_entities = filled_for_view();
+
+	auto render_entity = [&] (e_base* e) -> void {
+		if (cull_entities && !entity_cull.intersects(e->get_bbox()))
+			return;
+		if (entity_filter && !entity_filter(e))
+			return;
+
+		if (test_entities) {
+			t_bound_box b = e->get_bbox();
+			if (!vis_box_in_clip(clip_from_world, b)) {
+				num_entities_outside++;
+				frame_stats.entities_outside++;
+				return;
+			}
+			if (occluded(b)) {
+				num_entities_occluded++;
+				frame_stats.entities_occluded++;
+				return;
+			}
+		}
+
+		uint32_t mask = 0;
+		if (layered) {
+			mask = entity_layer_mask(*this, e);
+			if (mask == 0)
+				return;
+		} else if (!entity_contributes(e)) {
+			frame_stats.contrib_culled++;
+			return;
+		}
+		num_entities_rendered++;
+
+		if (!instancing_disabled && e->render_instanced(mask))
+			return;
+
+		if (layered)
+			glVertexAttribI1ui(ATTRIB_LOC_LAYER_MASK, mask);
+		e->render();
+	};
+
+	if (vis_gpu_driven) {
+		static std::vector<e_base*> entities;
+		entities.clear();
+		entities_in_view(entities);
+		for (e_base* e: entities)
+			render_entity(e);
+
+		vis_gpu_render_world(*this);
+		instances_flush();
+		impostors_flush();
+		return;
+	}
+
+	// the wireframe is drawn without culling faces
+	bool cull_clusters = vis_cluster_culling
+		&& render_ctx.stage != RENDER_STAGE_WIREFRAME;
+
+	const t_visible_set* views[MAX_RENDER_LAYERS] = { this };
+	for (int i = 0; i < layers.size(); i++)
+		views[i] = layers[i];
+
+	for (int i = 0; i < leaves.size(); i++) {
+		const oct_node* l = leaves[i];
+
 		// draw entities
 		for (e_base* e: l->entities_inside) {
 			if (e->render_last_guard_key == guard_key)
 				continue;
 			e->render_last_guard_key = guard_key;
-			e->render();
+			render_entity(e);
 		}
+
 		// draw world
+		uint32_t leaf_mask = layered ? leaf_layer_masks[i] : 1u;
+		world_mesh.bind();
 		for (const auto& gr: l->mat_buckets) {
+			uint32_t mask = bucket_layer_mask(gr, views, leaf_mask,
+					cull_clusters);
+			if (mask == 0)
+				continue;
+
+			if (layered)
+				glVertexAttribI1ui(ATTRIB_LOC_LAYER_MASK, mask);
 			gr.mat->apply();
-			glCallList(gr.display_list);
+			world_mesh.draw(gr.first, gr.count);
 		}
 	}
+
+	instances_flush();
+	impostors_flush();
+}
+
+bool t_visible_set::filled_for_view () const
+{
+	return layers.empty() && !cull_entities && !pass_all_nodes;
+}
+
+bool t_visible_set::may_see (const t_bound_box& b) const
+{
+	if (vis_gpu_driven)
+		return vis_box_in_clip(clip_from_world, b);
+
+	for (const oct_node* n: leaves) {
+		if (n->bounds.intersects(b))
+			return true;
+	}
+	return false;
 }
 
 
@@ -295,6 +1020,16 @@ void read_world_vis_data (std::string path)
 			f >> oct_max_depth;
 		} else if (option == "oct_capacity") {
 			f >> oct_leaf_capacity;
+		} else if (option == "oct_cluster") {
+			f >> oct_cluster_size;
+		} else if (option == "pvs_cell") {
+			f >> pvs_cell_size;
+		} else if (option == "pvs_samples") {
+			f >> pvs_samples;
+		} else if (option == "occ_auto") {
+			f >> occ_auto_budget;
+		} else if (option == "occ_auto_area") {
+			f >> occ_auto_min_area;
 		} else if (option == "bounds") {
 			f >> world_bounds_override.start >>
 				world_bounds_override.end;
@@ -307,19 +1042,58 @@ void read_world_vis_data (std::string path)
 
 void vis_initialize_world (const std::string& path)
 {
+	world_path = path;
+
+	// only what the map asks for
+	occ_auto_budget = 0;
 	read_world_vis_data(path + "/vis");
 
 	world.load_obj(path + "/geo.obj");
 
 	if (world_bounds_override.volume() > 0.0)
 		world.bbox = world_bounds_override;
+}
+
+/* The models baked so far, by name, until the map is done loading */
+static std::map<std::string, t_model_mem> bake_models;
 
+void vis_bake_static_model (const std::string& model_name, t_material* mat,
+		const mat4& transform)
+{
+	auto [iter, added] = bake_models.try_emplace(model_name);
+	if (added)
+		load_model_mem(model_name, iter->second);
+	const t_model_mem& mdl = iter->second;
+
+	// props are only ever translated and rotated
+	mat3 rotation = mat3(transform);
+	int base = world.vertices.size();
+
+	for (t_model_mem::vertex v: mdl.vertices) {
+		v.v.pos = vec3(transform * vec4(v.v.pos, 1.0));
+		v.v.norm = rotation * v.v.norm;
+		v.tangent = rotation * v.tangent;
+		world.vertices.push_back(v);
+
+		if (world_bounds_override.volume() <= 0.0)
+			world.bbox.expand(v.v.pos);
+	}
+
+	for (t_model_mem::triangle t: mdl.triangles) {
+		for (int i = 0; i < 3; i++)
+			t.index[i] += base;
+		t.material = mat;
+		world.triangles.push_back(t);
+	}
+}
+
+void vis_finish_world ()
+{
+	bake_models.clear();
 	root = new oct_node;
 
-	// Prepare the occlusion planes right away
-	occ_planes_dlist = glGenLists(1);
-	glNewList(occ_planes_dlist, GL_COMPILE);
-	glBegin(GL_TRIANGLES);
+	// The map's own occlusion planes, kept out of the octree
+	std::vector<float> occ_planes;
 	int n = world.triangles.size();
 
 	for (int i = 0; i < n; i++) {
@@ -327,16 +1101,31 @@ void vis_initialize_world (const std::string& path)
 		if (tri.material == mat_occlude) {
 			for (int j = 0; j < 3; j++) {
 				const vec3& ps = world.get_vertex(i, j).pos;
-				glVertex3f(ps.x, ps.y, ps.z);
+				occ_planes.insert(occ_planes.end(),
+						{ ps.x, ps.y, ps.z });
 			}
 		} else {
 			root->bucket.push_back(i);
 		}
 	}
-	glEnd();
-	glEndList();
 
 	root->build(world.bbox, 0);
+
+	// which needs the octree to look for the solids behind
+	vis_generate_occluders(occ_planes);
+	occ_planes_vao.upload(occ_planes);
+
+	world_mesh.load(world.mesh_vertices(), world_indices);
+	vector_clear_dealloc(world_indices);
+	vis_gpu_build_world(all_leaves.leaves, world_mesh);
+	pvs_load(world_path + "/pvs");
+
+	for (e_base* e: ents.vec)
+		vis_requery_entity(e);
+
+	// the lights filled theirs as they loaded, with no octree yet
+	light_cone_refill_vis();
+	light_sun_refill_vis();
 }
 
 void vis_destroy_world ()
@@ -344,10 +1133,40 @@ void vis_destroy_world ()
 	if (root != nullptr) {
 		delete root;
 		root = nullptr;
+		world_mesh.free();
+		all_leaves.leaves.clear();
+		vis_gpu_destroy_world();
+		pvs_free();
 	}
 }
 
 
+COMMAND_ROUTINE (vis_bake_pvs)
+{
+	if (ev != PRESS)
+		return;
+	if (root == nullptr) {
+		warning("vis_bake_pvs: no map loaded");
+		return;
+	}
+	pvs_bake(world_path + "/pvs");
+}
+
+COMMAND_ROUTINE (vis_stats)
+{
+	if (ev != PRESS)
+		return;
+
+	const t_visible_set& v = visible_set;
+	std::cout << "leaves " << v.leaves.size()
+		<< "/" << all_leaves.leaves.size()
+		<< ", entities " << v.num_entities_rendered
+		<< ", left out outside the view " << v.num_entities_outside
+		<< ", occluded " << v.num_entities_occluded << std::endl;
+	std::cout << "generated occluders " << occ_auto_generated
+		<< ", " << occ_auto_triangles << " triangles" << std::endl;
+}
+
 static bool debug_draw_wireframe = false;
 COMMAND_SET_BOOL (vis_wireframe, debug_draw_wireframe);
 
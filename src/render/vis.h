@@ -10,7 +10,22 @@
 
 void init_vis ();
 
+/* Remake the occlusion framebuffer for the current settings */
+void realloc_vis ();
+
+/*
+ * Loading a map goes as:
+ *   vis_initialize_world() reads the world geometry,
+ *   vis_bake_static_model() is called by static entities as they
+ *     load, adding the triangles of the model by that name to the
+ *     world in world space (each model is read once per map),
+ *   vis_finish_world() builds the octree out of all that, and puts
+ *     every entity into it
+ */
 void vis_initialize_world (const std::string& path);
+void vis_bake_static_model (const std::string& model_name, t_material* mat,
+		const mat4& transform);
+void vis_finish_world ();
 void vis_destroy_world ();
 
 /*
@@ -21,9 +36,28 @@ void vis_destroy_world ();
  *   split when exceeded, and maximum leaf depth, beyond which
  *   no leaf will ever be split.
  *
+ * A leaf's triangles are drawn in buckets by material, which the map
+ *   can also have split into clusters of at most so many triangles
+ *   that face about the same way. Buckets facing away from the eye
+ *   as a whole are not drawn (vis_cluster_cull).
+ *
  * The map specifies certain "occlusion planes", which are polygons
  *   that are rendered every frame into a depth buffer and against
  *   which the nodes of the octree are tested.
+ *
+ * More get made out of the world itself as it loads: flat pieces of
+ *   it with no gaps, found to be the faces of solids by casting
+ *   segments behind them, get their outlines cut down to at most 8
+ *   corners and sunk halfway into the solid, biggest first, until
+ *   the map's occ_auto triangles are used up (none without the
+ *   option). Pieces below occ_auto_area in area are not considered.
+ *
+ * A potentially visible set baked for the map can narrow the walk
+ *   down beforehand (render/pvs.h).
+ *
+ * The entities in the visible leaves get tested by themselves too,
+ *   against the view and then against that depth, read back a frame
+ *   late so as not to stall (vis_entity_occlusion).
  */
 
 struct t_visible_set;
@@ -35,16 +69,39 @@ struct oct_node
 	 */
 	struct mat_group {
 		t_material* mat;
-		GLuint display_list;
+
+		/* The range of the world mesh's indices */
+		int first;
+		int count;
+
+		/*
+		 * A cone bounding the triangles' normals. If the apex is
+		 *   seen from within asin(cone_cutoff) of the axis, every
+		 *   triangle faces away; the cutoff is above 1 if they
+		 *   point too many ways for that to ever hold
+		 */
+		vec3 cone_apex;
+		vec3 cone_axis;
+		float cone_cutoff;
+
+		/* Of the triangles, for contribution culling */
+		t_bound_box bounds;
+
+		/* w = 0 for an eye infinitely far in that direction */
+		bool faces_away (const vec4& eye) const;
 	};
 	std::vector<mat_group> mat_buckets;
 
 	/*
 	 * Indices into the triangle array of internal world model.
-	 * Empty after tree has been built!
+	 * Empty in non-leaves after the tree has been built!
 	 */
 	std::vector<int> bucket;
 
+	/* The leaves under this node, as a range of all_leaves */
+	int first_leaf;
+	int end_leaf;
+
 	GLuint query;
 
 	oct_node* children;
@@ -60,17 +117,251 @@ struct oct_node
 	~oct_node ();
 };
 
+/*
+ * A box which is axis-aligned in some space other than the world's
+ *   (e.g. a light's view space), for culling against.
+ * World-space boxes are tested conservatively, by the box containing
+ *   their image in that space
+ */
+struct t_cull_box
+{
+	mat4 to_box_space;
+	t_bound_box box;
+
+	bool intersects (const t_bound_box& world_box) const;
+};
+
 struct t_visible_set
 {
 	std::vector<const oct_node*> leaves;
 
+	/*
+	 * What the set was filled for, as one matrix into clip space:
+	 *   the view-projection for fill(), and for fill_cull_box() the
+	 *   one taking the box to the [-1, 1] cube. The GPU driven path
+	 *   culls against this instead of walking the leaves
+	 */
+	mat4 clip_from_world = mat4(1.0);
+
+	/* Which Hi-Z buffer fill() made for it; see vis_gpu_build_hiz() */
+	int hiz_id = 0;
+
+	/*
+	 * The eye the set is seen from, for culling clusters facing
+	 *   away from it: w = 0 for a direction, or all zero if none
+	 */
+	vec4 cull_eye = vec4(0.0);
+
+	/*
+	 * Contribution culling: entities and world buckets whose bounding
+	 *   spheres come out with a radius of fewer pixels than the
+	 *   threshold (vis_contrib_px, or vis_contrib_shadow_px for
+	 *   shadow views) are skipped, and so are entities farther from
+	 *   dist_origin than their draw_dist().
+	 * The scale is how many pixels a unit takes, at distance 1 from
+	 *   cull_eye, or anywhere if that is a direction; 0 for no culling
+	 *   by size. The view's owner sets these after filling the set
+	 */
+	float pixels_per_unit = 0.0;
+	bool shadow_view = false;
+	vec3 dist_origin = vec3(0.0);
+
+	void set_contribution (float pixels_per_unit, bool shadow_view,
+			vec3 dist_origin);
+	bool contributes (const t_bound_box& b) const;
+	bool entity_contributes (const e_base* e) const;
+
+	/*
+	 * The least radius over distance from cull_eye (or radius, if
+	 *   that is a direction) which contributes; 0 for any
+	 */
+	float min_size_ratio () const;
+
+	/*
+	 * If set, only the entities whose bounding boxes
+	 *   intersect this get rendered
+	 */
+	bool cull_entities = false;
+	t_cull_box entity_cull;
+
+	/* If set, only the entities for which it is true get rendered */
+	bool (*entity_filter) (const e_base*) = nullptr;
+
+	/*
+	 * The depth of the occlusion planes as fill() drew them, reduced
+	 *   to the farthest in each tile, for the entities to be tested
+	 *   against; empty if there is none.
+	 * It is read back without waiting on the GPU, so it is that of an
+	 *   earlier fill(), about a frame ago, drawn with occ_tiles_clip.
+	 * Unless occ_any_view is set, occluded() only goes by it while the
+	 *   set is still seen from that same view, so that a cone light's
+	 *   cached map never has casters culled as seen from where it was
+	 *   before. The camera's set has it set, as its view changes every
+	 *   frame: an entity coming out from behind an occluder as the
+	 *   view moves or turns may then show up a frame or so late
+	 */
+	std::vector<float> occ_tiles;
+	int occ_tiles_size = 0;
+	mat4 occ_tiles_clip = mat4(1.0);
+	bool occ_any_view = false;
+
+	/* The readback on its way into the pixel buffer, if any */
+	GLuint occ_pbo = 0;
+	GLsync occ_fence = nullptr;
+	mat4 occ_pending_clip;
+	int occ_pending_size = 0;
+	bool occ_pending_reduced = false;
+	void free_occ_readback ();
+
+	/*
+	 * Take the readback up if the GPU is done with it, as fill() does;
+	 *   for sets which get rendered again without being filled again
+	 */
+	void take_occ_readback ();
+
+	/* Whether the box is surely hidden behind the occlusion planes */
+	bool occluded (const t_bound_box& b) const;
+
+	/*
+	 * How many entities the latest render() drew, and how many of
+	 *   those in the leaves it left out for being outside the view,
+	 *   or occluded
+	 */
+	mutable int num_entities_rendered = 0;
+	mutable int num_entities_outside = 0;
+	mutable int num_entities_occluded = 0;
+
+	/*
+	 * Layered rendering: the union of the layers' sets, with every
+	 *   leaf and entity drawn once, with the mask of the layers
+	 *   it belongs to. Entities get culled by each layer's rules.
+	 *   Layers that are null get skipped
+	 */
+	std::vector<const t_visible_set*> layers;
+	std::vector<uint32_t> leaf_layer_masks;
+
 	void fill ();
+
+	/*
+	 * Fill with all the leaves intersecting the box, and have it
+	 *   cull the entities against the same box. No occlusion testing
+	 */
+	void fill_cull_box (const t_cull_box& cb, vec4 eye = vec4(0.0));
+
+	/* Fill as the union of the layer sets, for layered rendering */
+	void fill_layered (const std::vector<const t_visible_set*>& sets);
+
 	void render () const;
 	void render_debug () const;
+
+	/* Whether anything in the box might be in the set */
+	bool may_see (const t_bound_box& b) const;
+
+	/*
+	 * Whether it was filled for a view, by fill(), and so has its
+	 *   entities tested against that, and the world narrowed down by
+	 *   the PVS as seen from cull_eye; not so for the layered sets,
+	 *   those culling by a box, or any with vis_disable
+	 */
+	bool filled_for_view () const;
+
+	/*
+	 * The GPU driven mode has no leaves to take the entities from, so
+	 *   they come out of the octree, skipping the nodes outside the
+	 *   view or the PVS like fill() would have. Each is added once
+	 */
+	void entities_in_view (std::vector<e_base*>& out) const;
 };
 
 extern t_visible_set all_leaves;
 
+extern int occ_auto_budget;
+extern float occ_auto_min_area;
+
+/* How many the latest map got, and of how many triangles, for vis_stats */
+extern int occ_auto_generated;
+extern int occ_auto_triangles;
+
+/* Append the generated occluders to those, as triangles' corners */
+void vis_generate_occluders (std::vector<float>& occ_planes);
+
+/*
+ * The world triangle which the segment from a to b hits, but for the
+ *   distance skip at either end; -1 if none. With t, the nearest,
+ *   and where along the segment (0 to 1) it is; without, just any
+ */
+int vis_segment_hit (const vec3& a, const vec3& b, float skip,
+		float* t = nullptr);
+
+extern bool vis_cluster_culling;
+
 void vis_requery_entity (e_base* e);
 
+/*
+ * GPU driven mode (vis_gpu 1): the visible sets leave their leaves
+ *   empty, and the world gets culled and drawn without the CPU ever
+ *   walking the octree. The leaves' bounds and their material buckets
+ *   are in storage buffers; a compute shader (internal/vis_cull.comp)
+ *   tests each bucket against the PVS where fill() would go by it,
+ *   against the set's clip_from_world (or its layers'), for facing away
+ *   from its cull_eye, for its contribution as above, and against the
+ *   Hi-Z buffer fill() made, then writes the survivors'
+ *   DrawElementsIndirectCommands, packed per material, which one
+ *   glMultiDrawElementsIndirect(Count) per material draws. What it
+ *   culls does not show in the frame stats.
+ * Entities get culled one by one on the CPU instead, against the same
+ *   matrices, and a coarse level of the Hi-Z buffer, read back a frame
+ *   late (t_visible_set::occ_tiles); the visibility buffer records the
+ *   world's draws on the CPU too, as it needs an ID for each
+ *   (render/visbuf.h)
+ */
+extern bool vis_gpu_driven;
+
+void init_vis_gpu ();
+/* Remake the Hi-Z buffer for the current occ_fbo_size */
+void vis_gpu_realloc ();
+
+void vis_gpu_build_world (const std::vector<const oct_node*>& leaves,
+		const t_mesh& world_mesh);
+void vis_gpu_destroy_world ();
+
+/*
+ * Make the Hi-Z buffer, a mip chain of the farthest depth, out of
+ *   the occlusion planes in occ_fbo; returns an ID which stays
+ *   current until the next one gets made
+ */
+int vis_gpu_build_hiz ();
+
+/*
+ * Read the coarsest level of the Hi-Z buffer at most max_size across
+ *   into the bound pixel pack buffer; returns how many across it is
+ */
+int vis_gpu_read_hiz (int max_size);
+
+void vis_gpu_render_world (const t_visible_set& s);
+
+namespace uniform_loc_vis_gpu
+{
+	/* internal/vis_cull.comp */
+	constexpr int views = 0; // MAX_RENDER_LAYERS of them
+	constexpr int views_used = 8;
+	constexpr int occlusion = 9;
+	constexpr int num_buckets = 10;
+	constexpr int hiz = 11;
+	constexpr int cull_eyes = 12; // MAX_RENDER_LAYERS of them
+	constexpr int min_size = 20; // same
+	constexpr int cull_clusters = 28;
+	constexpr int use_pvs = 29;
+
+	/* internal/vis_hiz.comp */
+	constexpr int level = 0;
+	constexpr int depth = 1;
+}
+
+/* Whether the box is at least partly in the clip space cube */
+bool vis_box_in_clip (const mat4& clip_from_world, const t_bound_box& b);
+
+/* The matrix taking the inside of the cull box to the [-1, 1] cube */
+mat4 vis_cull_box_clip (const t_cull_box& cb);
+
 #endif // VIS_H
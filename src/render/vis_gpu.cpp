@@ -0,0 +1,445 @@
+#include "render/vis.h"
+#include "render/framebuffer.h"
+#include "render/resource.h"
+#include "render/settings.h"
+#include "render/pvs.h"
+#include "render/light/cone.h"
+#include "input/cmds.h"
+#include <map>
+
+bool vis_gpu_driven = false;
+
+COMMAND_ROUTINE (vis_gpu)
+{
+	if (ev != PRESS || args.empty())
+		return;
+
+	bool on = atoi(args[0].c_str());
+	if (on == vis_gpu_driven)
+		return;
+	vis_gpu_driven = on;
+
+	// the lights' sets were filled the other way
+	light_cone_refill_vis();
+}
+
+extern t_fbo occ_fbo;
+
+/* As internal/vis_cull.comp has them */
+struct t_gpu_leaf
+{
+	vec4 start;
+	vec4 end;
+};
+
+struct t_gpu_bucket
+{
+	/* The cone's apex and cutoff, its axis, and the bounding sphere */
+	vec4 cone_apex;
+	vec4 cone_axis;
+	vec4 sphere;
+
+	uint32_t leaf;
+	uint32_t first;
+	uint32_t count;
+	uint32_t material;
+
+	/* Where the commands of the material start */
+	uint32_t region;
+	uint32_t pad[3];
+};
+static_assert(sizeof(t_gpu_bucket) == 80,
+	"internal/vis_cull.comp expects t_bucket to be 80 bytes");
+
+struct t_draw_elements_command
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
+};
+
+/* The compute shader only writes the layer mask, the last word */
+static_assert(sizeof(t_instance) == 17 * sizeof(uint32_t),
+	"internal/vis_cull.comp expects t_instance to be 17 words");
+
+/* The commands for the buckets of a material are a range of their own */
+struct t_material_region
+{
+	const t_material* mat;
+	int first;
+	int size;
+};
+
+static std::vector<t_material_region> regions;
+static std::vector<const oct_node*> world_leaves;
+static const t_mesh* world_mesh = nullptr;
+static int num_buckets = 0;
+
+static GLuint leaf_buffer;
+static GLuint bucket_buffer;
+static GLuint command_buffer;
+static GLuint count_buffer;
+static GLuint instance_buffer;
+static GLuint pvs_buffer;
+
+static GLuint cull_program;
+static GLuint hiz_program;
+static GLuint hiz_tex = 0;
+static int hiz_levels = 0;
+static int current_hiz = 0;
+
+/* Compute only, so the material slots are free to take */
+constexpr int slot_depth = 0;
+constexpr int slot_hiz = 0;
+
+void init_vis_gpu ()
+{
+	cull_program = make_glsl_program({ get_shader(
+		"internal/vis_cull.comp", GL_COMPUTE_SHADER) });
+	glUseProgram(cull_program);
+	glUniform1i(uniform_loc_vis_gpu::hiz, slot_hiz);
+
+	hiz_program = make_glsl_program({ get_shader(
+		"internal/vis_hiz.comp", GL_COMPUTE_SHADER) });
+	glUseProgram(hiz_program);
+	glUniform1i(uniform_loc_vis_gpu::depth, slot_depth);
+
+	glCreateBuffers(1, &pvs_buffer);
+}
+
+void vis_gpu_realloc ()
+{
+	if (hiz_tex != 0)
+		glDeleteTextures(1, &hiz_tex);
+
+	hiz_levels = 1;
+	while (occ_fbo_size >> hiz_levels)
+		hiz_levels++;
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &hiz_tex);
+	glTextureStorage2D(hiz_tex, hiz_levels, GL_R32F,
+			occ_fbo_size, occ_fbo_size);
+	glTextureParameteri(hiz_tex, GL_TEXTURE_MIN_FILTER,
+			GL_NEAREST_MIPMAP_NEAREST);
+	glTextureParameteri(hiz_tex, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	// whatever was made before is gone
+	current_hiz++;
+}
+
+void vis_gpu_build_world (const std::vector<const oct_node*>& leaves,
+		const t_mesh& mesh)
+{
+	world_leaves = leaves;
+	world_mesh = &mesh;
+
+	std::vector<t_gpu_leaf> gpu_leaves;
+	std::map<const t_material*, std::vector<t_gpu_bucket>> by_material;
+
+	for (size_t i = 0; i < leaves.size(); i++) {
+		const oct_node* l = leaves[i];
+		gpu_leaves.push_back({ vec4(l->bounds.start, 1.0),
+		                       vec4(l->bounds.end, 1.0) });
+
+		for (const auto& gr: l->mat_buckets) {
+			// these draw nothing in the first place
+			if (gr.mat->name.empty())
+				continue;
+			t_gpu_bucket b = { };
+			b.cone_apex = vec4(gr.cone_apex, gr.cone_cutoff);
+			b.cone_axis = vec4(gr.cone_axis, 0.0);
+			b.sphere = vec4((gr.bounds.start + gr.bounds.end) * 0.5f,
+				glm::length(gr.bounds.end - gr.bounds.start) * 0.5f);
+			b.leaf = i;
+			b.first = gr.first;
+			b.count = gr.count;
+			by_material[gr.mat].push_back(b);
+		}
+	}
+
+	regions.clear();
+	std::vector<t_gpu_bucket> buckets;
+
+	for (auto& [mat, bs]: by_material) {
+		uint32_t m = regions.size();
+		uint32_t first = buckets.size();
+		regions.push_back({ mat, (int) first, (int) bs.size() });
+
+		for (t_gpu_bucket& b: bs) {
+			b.material = m;
+			b.region = first;
+			buckets.push_back(b);
+		}
+	}
+
+	num_buckets = buckets.size();
+	if (num_buckets == 0)
+		return;
+
+	glCreateBuffers(1, &leaf_buffer);
+	glNamedBufferStorage(leaf_buffer,
+			sizeof(gpu_leaves[0]) * gpu_leaves.size(),
+			gpu_leaves.data(), 0);
+
+	glCreateBuffers(1, &bucket_buffer);
+	glNamedBufferStorage(bucket_buffer,
+			sizeof(buckets[0]) * buckets.size(),
+			buckets.data(), 0);
+
+	glCreateBuffers(1, &command_buffer);
+	glNamedBufferStorage(command_buffer,
+			sizeof(t_draw_elements_command) * num_buckets,
+			nullptr, 0);
+
+	glCreateBuffers(1, &count_buffer);
+	glNamedBufferStorage(count_buffer,
+			sizeof(GLuint) * regions.size(), nullptr, 0);
+
+	// the world is in world space already; each command draws one
+	// instance, whose layer mask the compute shader fills in
+	std::vector<t_instance> instances(num_buckets, { mat4(1.0), 0 });
+	glCreateBuffers(1, &instance_buffer);
+	glNamedBufferStorage(instance_buffer,
+			sizeof(instances[0]) * instances.size(),
+			instances.data(), 0);
+}
+
+void vis_gpu_destroy_world ()
+{
+	if (num_buckets > 0) {
+		GLuint buffers[] = { leaf_buffer, bucket_buffer,
+			command_buffer, count_buffer, instance_buffer };
+		glDeleteBuffers(5, buffers);
+	}
+
+	num_buckets = 0;
+	regions.clear();
+	world_leaves.clear();
+	world_mesh = nullptr;
+}
+
+int vis_gpu_build_hiz ()
+{
+	glUseProgram(hiz_program);
+	bind_tex2d_to_slot(slot_depth, occ_fbo.depth->id);
+
+	for (int level = 0; level < hiz_levels; level++) {
+		int size = std::max(occ_fbo_size >> level, 1);
+
+		// level 0 comes from the depth instead
+		glBindImageTexture(0, hiz_tex, std::max(level - 1, 0),
+				GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, hiz_tex, level,
+				GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glUniform1i(uniform_loc_vis_gpu::level, level);
+
+		glDispatchCompute((size + 7) / 8, (size + 7) / 8, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	material_barrier();
+	return ++current_hiz;
+}
+
+int vis_gpu_read_hiz (int max_size)
+{
+	int level = 0;
+	while (level + 1 < hiz_levels && (occ_fbo_size >> level) > max_size)
+		level++;
+	int size = std::max(occ_fbo_size >> level, 1);
+
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glGetTextureImage(hiz_tex, level, GL_RED, GL_FLOAT,
+			size * size * sizeof(float), nullptr);
+	return size;
+}
+
+/*
+ * The visibility buffer gives out an ID for every draw on the CPU, so
+ *   cull the leaves here instead, by the matrix alone
+ */
+static void render_world_cpu (const t_visible_set& s)
+{
+	bool use_pvs = s.filled_for_view();
+
+	world_mesh->bind();
+	for (size_t i = 0; i < world_leaves.size(); i++) {
+		const oct_node* l = world_leaves[i];
+		if (!vis_box_in_clip(s.clip_from_world, l->bounds))
+			continue;
+		if (use_pvs && !pvs_may_see(vec3(s.cull_eye), i, i + 1))
+			continue;
+		for (const auto& gr: l->mat_buckets) {
+			if (vis_cluster_culling && gr.faces_away(s.cull_eye)) {
+				frame_stats.clusters_culled++;
+				continue;
+			}
+			if (!s.contributes(gr.bounds)) {
+				frame_stats.contrib_culled++;
+				continue;
+			}
+			gr.mat->apply();
+			world_mesh->draw(gr.first, gr.count);
+		}
+	}
+}
+
+static void cull (const t_visible_set& s)
+{
+	namespace loc = uniform_loc_vis_gpu;
+
+	glUseProgram(cull_program);
+	material_barrier();
+
+	std::array<mat4, MAX_RENDER_LAYERS> views;
+	std::array<vec4, MAX_RENDER_LAYERS> eyes = { };
+	std::array<float, MAX_RENDER_LAYERS> min_size = { };
+	uint32_t views_used = 0;
+
+	auto add_view = [&] (int i, const t_visible_set& v) -> void {
+		views[i] = v.clip_from_world;
+		eyes[i] = v.cull_eye;
+		min_size[i] = v.min_size_ratio();
+		views_used |= 1u << i;
+	};
+	if (s.layers.empty())
+		add_view(0, s);
+	for (int i = 0; i < s.layers.size(); i++) {
+		if (s.layers[i] != nullptr)
+			add_view(i, *s.layers[i]);
+	}
+
+	// the wireframe is drawn without culling faces
+	bool cull_clusters = vis_cluster_culling
+		&& render_ctx.stage != RENDER_STAGE_WIREFRAME;
+
+	bool occlusion = s.hiz_id != 0 && s.hiz_id == current_hiz;
+
+	// what fill() would have walked the octree by
+	static std::vector<uint32_t> pvs_words;
+	bool use_pvs = s.filled_for_view()
+		&& pvs_cell_set(vec3(s.cull_eye), pvs_words);
+	if (use_pvs) {
+		glNamedBufferData(pvs_buffer,
+				sizeof(pvs_words[0]) * pvs_words.size(),
+				pvs_words.data(), GL_STREAM_DRAW);
+	}
+
+	glUniformMatrix4fv(loc::views, MAX_RENDER_LAYERS, GL_FALSE,
+			glm::value_ptr(views[0]));
+	glUniform1ui(loc::views_used, views_used);
+	glUniform4fv(loc::cull_eyes, MAX_RENDER_LAYERS,
+			glm::value_ptr(eyes[0]));
+	glUniform1fv(loc::min_size, MAX_RENDER_LAYERS, min_size.data());
+	glUniform1i(loc::cull_clusters, cull_clusters);
+	glUniform1i(loc::occlusion, occlusion);
+	glUniform1i(loc::use_pvs, use_pvs);
+	glUniform1ui(loc::num_buckets, num_buckets);
+	bind_tex2d_to_slot(slot_hiz, hiz_tex);
+
+	GLuint zero = 0;
+	glClearNamedBufferData(command_buffer, GL_R32UI, GL_RED_INTEGER,
+			GL_UNSIGNED_INT, &zero);
+	glClearNamedBufferData(count_buffer, GL_R32UI, GL_RED_INTEGER,
+			GL_UNSIGNED_INT, &zero);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, leaf_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bucket_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, count_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, instance_buffer);
+	if (use_pvs)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, pvs_buffer);
+
+	glDispatchCompute((num_buckets + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT
+			| GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void vis_gpu_render_world (const t_visible_set& s)
+{
+	if (num_buckets == 0)
+		return;
+
+	if (mesh_visbuf_recording) {
+		render_world_cpu(s);
+		return;
+	}
+
+	cull(s);
+
+	restorer rest(render_ctx);
+	render_ctx.model = mat4(1.0);
+	render_ctx.instanced = true;
+
+	// with the count, the GPU skips the commands which were culled;
+	// without, those are left zero, and draw nothing
+	bool counted = GLEW_ARB_indirect_parameters;
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+	if (counted)
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, count_buffer);
+
+	for (size_t m = 0; m < regions.size(); m++) {
+		const t_material_region& r = regions[m];
+		const void* first = (const void*)
+			(r.first * sizeof(t_draw_elements_command));
+
+		r.mat->apply();
+		world_mesh->bind_instanced(instance_buffer, 0);
+
+		if (counted) {
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES,
+				GL_UNSIGNED_INT, first, m * sizeof(GLuint),
+				r.size, 0);
+		} else {
+			glMultiDrawElementsIndirect(GL_TRIANGLES,
+				GL_UNSIGNED_INT, first, r.size, 0);
+		}
+		frame_stats.draw_calls++;
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	if (counted)
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+}
+
+
+bool vis_box_in_clip (const mat4& clip_from_world, const t_bound_box& b)
+{
+	// outside only if all the corners are beyond the same plane
+	int beyond[6] = { };
+
+	for (int i = 0; i < 8; i++) {
+		vec3 p = { (i & 1 ? b.end : b.start).x,
+		           (i & 2 ? b.end : b.start).y,
+		           (i & 4 ? b.end : b.start).z };
+		vec4 c = clip_from_world * vec4(p, 1.0);
+
+		beyond[0] += c.x < -c.w;
+		beyond[1] += c.x > c.w;
+		beyond[2] += c.y < -c.w;
+		beyond[3] += c.y > c.w;
+		beyond[4] += c.z < -c.w;
+		beyond[5] += c.z > c.w;
+	}
+
+	for (int n: beyond) {
+		if (n == 8)
+			return false;
+	}
+	return true;
+}
+
+mat4 vis_cull_box_clip (const t_cull_box& cb)
+{
+	vec3 mid = (cb.box.start + cb.box.end) * 0.5f;
+	vec3 half_size = (cb.box.end - cb.box.start) * 0.5f;
+
+	return glm::scale(mat4(1.0), 1.0f / half_size)
+	     * glm::translate(mat4(1.0), -mid)
+	     * cb.to_box_space;
+}
@@ -0,0 +1,324 @@
+#include "render/visbuf.h"
+#include "render/gbuffer.h"
+#include "render/render.h"
+#include "render/resource.h"
+#include "render/instancing.h"
+#include "render/vis.h"
+#include "input/cmds.h"
+#include <map>
+
+bool visbuf_enabled = false;
+t_fbo visbuf_fbo;
+
+COMMAND_ROUTINE (render_visbuf)
+{
+	if (ev != PRESS || args.empty())
+		return;
+	visbuf_enabled = atoi(args[0].c_str());
+}
+
+/* What a draw ID stands for */
+struct t_visbuf_draw
+{
+	mat4 model;
+	uint32_t first_index;
+	uint32_t group;
+};
+
+/* The draws which share a material and a mesh get resolved together */
+struct t_visbuf_group
+{
+	const t_material* mat;
+	const t_mesh* mesh;
+};
+
+static std::vector<t_visbuf_draw> draws;
+static std::vector<t_visbuf_group> groups;
+static std::map<std::pair<const t_material*, const t_mesh*>, int> group_ids;
+static const t_material* current_material = nullptr;
+
+/* As glDrawArraysIndirect takes it; see internal/visbuf/classify.comp */
+struct t_draw_command
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first;
+	GLuint base_instance;
+};
+
+static GLuint draws_buffer;
+static GLuint draws_tex;
+static GLuint draw_groups_buffer;
+static GLuint draw_groups_tex;
+static GLuint command_buffer;
+static GLuint tiles_buffer;
+static GLuint tiles_tex;
+static int tiles_allocated = 0;
+
+static GLuint classify_program;
+static GLuint empty_vao;
+
+/* Past those of the materials' bitmaps */
+constexpr int slot_tiles = 10;
+constexpr int slot_ids = 11;
+constexpr int slot_draws = 12;
+constexpr int slot_draw_groups = 13;
+constexpr int slot_vertices = 14;
+constexpr int slot_indices = 15;
+
+void init_visbuf ()
+{
+	int w = sdlctx.res_x;
+	int h = sdlctx.res_y;
+
+	// the depth goes straight into the G-buffer's
+	visbuf_fbo.make()
+		.attach_color(make_tex2d(w, h, GL_R32UI))
+		.attach_depth(gbuf_fbo.depth.ptr)
+		.assert_complete();
+	sspace_add_buffer(visbuf_fbo);
+
+	glCreateBuffers(1, &draws_buffer);
+	glCreateBuffers(1, &draw_groups_buffer);
+	glCreateBuffers(1, &command_buffer);
+	glCreateBuffers(1, &tiles_buffer);
+	glCreateTextures(GL_TEXTURE_BUFFER, 1, &draws_tex);
+	glCreateTextures(GL_TEXTURE_BUFFER, 1, &draw_groups_tex);
+	glCreateTextures(GL_TEXTURE_BUFFER, 1, &tiles_tex);
+
+	glCreateVertexArrays(1, &empty_vao);
+
+	classify_program = make_glsl_program({ get_shader(
+		"internal/visbuf/classify.comp", GL_COMPUTE_SHADER) });
+	glUseProgram(classify_program);
+	glUniform1i(uniform_loc_visbuf::ids, slot_ids);
+	glUniform1i(uniform_loc_visbuf::draw_groups, slot_draw_groups);
+}
+
+void visbuf_init_resolve ()
+{
+	namespace loc = uniform_loc_visbuf;
+	glUniform1i(loc::tiles, slot_tiles);
+	glUniform1i(loc::ids, slot_ids);
+	glUniform1i(loc::draws, slot_draws);
+	glUniform1i(loc::draw_groups, slot_draw_groups);
+	glUniform1i(loc::vertices, slot_vertices);
+	glUniform1i(loc::indices, slot_indices);
+}
+
+void visbuf_use_material (const t_material* mat)
+{
+	current_material = mat;
+}
+
+static void resolve_batch ();
+
+/* Resolve what has been recorded, and go on recording the mesh's draw */
+static void next_batch (const t_mesh& mesh)
+{
+	resolve_batch();
+
+	visbuf_fbo.apply();
+	const GLuint empty[4] = { VISBUF_EMPTY };
+	glClearBufferuiv(GL_COLOR, 0, empty);
+	glEnable(GL_DEPTH_TEST);
+
+	// as the draw had it before the resolve
+	material_barrier();
+	current_material->apply();
+	mesh.bind();
+}
+
+/* The mesh's group with the current material, made if need be */
+static int group_of (const t_mesh& mesh)
+{
+	auto key = std::make_pair(current_material, &mesh);
+	auto i = group_ids.find(key);
+	if (i != group_ids.end())
+		return i->second;
+
+	if (groups.size() == MAX_VISBUF_GROUPS)
+		next_batch(mesh);
+	groups.push_back({ current_material, &mesh });
+	group_ids[key] = groups.size() - 1;
+	return groups.size() - 1;
+}
+
+void visbuf_draw (const t_mesh& mesh, int first, int count)
+{
+	const t_material* mat = current_material;
+	if (mat == nullptr || mat->name.empty())
+		return;
+
+	// as many triangles as an ID tells apart in each piece
+	constexpr int max_count = 3 << VISBUF_TRIANGLE_BITS;
+	for (int start = first; start < first + count; start += max_count) {
+		if (draws.size() == MAX_VISBUF_DRAWS)
+			next_batch(mesh);
+		int group = group_of(mesh);
+
+		glUniform1ui(uniform_loc_visbuf::draw_id, draws.size());
+		draws.push_back({ render_ctx.model, (uint32_t) start,
+		                  (uint32_t) group });
+
+		int n = std::min(max_count, first + count - start);
+		glDrawElements(GL_TRIANGLES, n, GL_UNSIGNED_INT,
+			(const void*) (start * sizeof(uint32_t)));
+		frame_stats.draw_calls++;
+	}
+}
+
+static void upload_draws ()
+{
+	std::vector<vec4> texels;
+	std::vector<uint32_t> draw_groups;
+	texels.reserve(VISBUF_DRAW_TEXELS * draws.size());
+	draw_groups.reserve(draws.size());
+
+	for (const t_visbuf_draw& d: draws) {
+		for (int c = 0; c < 4; c++)
+			texels.push_back(d.model[c]);
+		texels.push_back(vec4(glm::uintBitsToFloat(d.first_index)));
+		draw_groups.push_back(d.group);
+	}
+
+	glNamedBufferData(draws_buffer, sizeof(texels[0]) * texels.size(),
+			texels.data(), GL_STREAM_DRAW);
+	glTextureBuffer(draws_tex, GL_RGBA32F, draws_buffer);
+
+	glNamedBufferData(draw_groups_buffer,
+			sizeof(draw_groups[0]) * draw_groups.size(),
+			draw_groups.data(), GL_STREAM_DRAW);
+	glTextureBuffer(draw_groups_tex, GL_R32UI, draw_groups_buffer);
+}
+
+/* Fill in the commands and the tile lists; returns the tiles per list */
+static int classify_tiles ()
+{
+	int tiles_x = (gbuf_fbo.width + VISBUF_TILE_SIZE - 1)
+		/ VISBUF_TILE_SIZE;
+	int tiles_y = (gbuf_fbo.height + VISBUF_TILE_SIZE - 1)
+		/ VISBUF_TILE_SIZE;
+	int num_tiles = tiles_x * tiles_y;
+
+	if (num_tiles > tiles_allocated) {
+		tiles_allocated = num_tiles;
+		glNamedBufferData(tiles_buffer, sizeof(uint32_t)
+				* MAX_VISBUF_GROUPS * num_tiles,
+				nullptr, GL_DYNAMIC_COPY);
+		glTextureBuffer(tiles_tex, GL_R32UI, tiles_buffer);
+	}
+
+	// six vertices, and no tiles yet
+	std::vector<t_draw_command> commands(groups.size(), { 6, 0, 0, 0 });
+	glNamedBufferData(command_buffer,
+			sizeof(commands[0]) * commands.size(),
+			commands.data(), GL_STREAM_DRAW);
+
+	glUseProgram(classify_program);
+	bind_to_slot(slot_ids, GL_TEXTURE_2D, visbuf_fbo.color[0]->id);
+	bind_to_slot(slot_draw_groups, GL_TEXTURE_BUFFER, draw_groups_tex);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, command_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, tiles_buffer);
+
+	glDispatchCompute(tiles_x, tiles_y, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	return num_tiles;
+}
+
+/* Texture buffer views of the mesh, made when it is first resolved */
+static void bind_mesh (const t_mesh& mesh)
+{
+	if (mesh.vertex_tex == 0) {
+		glCreateTextures(GL_TEXTURE_BUFFER, 1, &mesh.vertex_tex);
+		glTextureBuffer(mesh.vertex_tex, GL_R32F, mesh.vbo);
+		glCreateTextures(GL_TEXTURE_BUFFER, 1, &mesh.index_tex);
+		glTextureBuffer(mesh.index_tex, GL_R32UI, mesh.ibo);
+	}
+
+	bind_to_slot(slot_vertices, GL_TEXTURE_BUFFER, mesh.vertex_tex);
+	bind_to_slot(slot_indices, GL_TEXTURE_BUFFER, mesh.index_tex);
+}
+
+static void resolve (int num_tiles)
+{
+	namespace loc = uniform_loc_visbuf;
+
+	gbuf_fbo.apply();
+	glDisable(GL_DEPTH_TEST);
+
+	glBindVertexArray(empty_vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+
+	bind_to_slot(slot_tiles, GL_TEXTURE_BUFFER, tiles_tex);
+	bind_to_slot(slot_ids, GL_TEXTURE_2D, visbuf_fbo.color[0]->id);
+	bind_to_slot(slot_draws, GL_TEXTURE_BUFFER, draws_tex);
+	bind_to_slot(slot_draw_groups, GL_TEXTURE_BUFFER, draw_groups_tex);
+
+	uint32_t features = 0;
+	if (gbuffer_composite)
+		features |= MAT_FEATURE_ALBEDO;
+
+	for (size_t g = 0; g < groups.size(); g++) {
+		const t_material::t_variant& v = groups[g].mat->get_variant(
+				RENDER_STAGE_VISBUF_RESOLVE, features);
+
+		glUseProgram(v.program->id);
+		for (auto [slot, texid]: v.textures)
+			bind_tex2d_to_slot(slot, texid);
+		bind_mesh(*groups[g].mesh);
+
+		glUniform1ui(loc::group, g);
+		glUniform1ui(loc::tile_offset, g * num_tiles);
+		glUniform1ui(loc::tiles_x, (gbuf_fbo.width
+				+ VISBUF_TILE_SIZE - 1) / VISBUF_TILE_SIZE);
+		glUniform2f(loc::screen_size, gbuf_fbo.width, gbuf_fbo.height);
+
+		glDrawArraysIndirect(GL_TRIANGLES,
+			(const void*) (g * sizeof(t_draw_command)));
+		frame_stats.draw_calls++;
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glEnable(GL_DEPTH_TEST);
+
+	// the programs have changed behind the materials' back
+	material_barrier();
+}
+
+static void resolve_batch ()
+{
+	if (!draws.empty()) {
+		upload_draws();
+		resolve(classify_tiles());
+	}
+
+	draws.clear();
+	groups.clear();
+	group_ids.clear();
+}
+
+void visbuf_fill ()
+{
+	visbuf_fbo.apply();
+	const GLuint empty[4] = { VISBUF_EMPTY };
+	glClearBufferuiv(GL_COLOR, 0, empty);
+
+	draws.clear();
+	groups.clear();
+	group_ids.clear();
+	current_material = nullptr;
+
+	// every prop needs an ID of its own
+	restorer rest(instancing_disabled);
+	instancing_disabled = true;
+
+	render_ctx.stage = RENDER_STAGE_VISIBILITY;
+	mesh_visbuf_recording = true;
+	visible_set.render();
+	mesh_visbuf_recording = false;
+
+	resolve_batch();
+	gbuf_fbo.apply();
+}
@@ -0,0 +1,76 @@
+#ifndef VISBUF_H
+#define VISBUF_H
+
+#include "render/framebuffer.h"
+#include "render/material.h"
+
+/*
+ * Visibility buffer: an alternative way of filling the G-buffers.
+ *
+ * The visible set gets rasterized once, into a single R32UI target of
+ *   which draw, and which of its triangles, covers each pixel, along
+ *   with the depth. Then, for every group of draws sharing a material
+ *   and a mesh, a screenspace pass fetches the triangles back from the
+ *   mesh's buffers, interpolates them, and runs the material's surface
+ *   functions to write the G-buffers like RENDER_STAGE_G_BUFFERS does.
+ * These passes only cover the tiles the group shows up in, which a
+ *   compute pass works out (internal/visbuf/classify.comp), and the
+ *   resolve draws straight from that (glDrawArraysIndirect).
+ * When the draws run out of IDs, or the groups out of tile lists, what
+ *   has been recorded gets resolved right there, and the rest recorded
+ *   over it, the IDs cleared but the depth kept: only what comes out
+ *   in front gets resolved again
+ *
+ * Vertices are taken as they are in the mesh, as common/identity does;
+ *   props are not drawn instanced in this mode
+ */
+
+extern bool visbuf_enabled;
+extern t_fbo visbuf_fbo;
+
+void init_visbuf ();
+
+/* Fill the G-buffers, cleared and applied beforehand, as said above */
+void visbuf_fill ();
+
+/* Set the samplers of a freshly made RENDER_STAGE_VISBUF_RESOLVE program */
+void visbuf_init_resolve ();
+
+/*
+ * Called by t_material::apply while rendering the visibility buffer;
+ *   then, t_mesh::draw leaves the draw to visbuf_draw, which gives it
+ *   its ID, or several for the pieces of one with more triangles than
+ *   an ID tells apart, and draws it (unless it has no actual material)
+ */
+void visbuf_use_material (const t_material* mat);
+
+/*
+ * The shaders get these #defined but for VISBUF_EMPTY, all ones, see
+ *   render/settings.h and internal/visbuf/_visbuf.inc.
+ * A draw's texels are its model matrix, then its first index
+ */
+constexpr int VISBUF_TRIANGLE_BITS = 18;
+constexpr int VISBUF_DRAW_TEXELS = 5;
+constexpr uint32_t VISBUF_EMPTY = 0xFFFFFFFF;
+// the last ID would make VISBUF_EMPTY out of its last triangle
+constexpr int MAX_VISBUF_DRAWS = (1 << (32 - VISBUF_TRIANGLE_BITS)) - 1;
+constexpr int VISBUF_TILE_SIZE = 16;
+// each group gets a list with room for every tile of the screen
+constexpr int MAX_VISBUF_GROUPS = 256;
+
+namespace uniform_loc_visbuf
+{
+	constexpr int tiles = 210;
+	constexpr int tile_offset = 211;
+	constexpr int tiles_x = 212;
+	constexpr int screen_size = 213;
+	constexpr int ids = 214;
+	constexpr int draws = 215;
+	constexpr int draw_groups = 216;
+	constexpr int vertices = 217;
+	constexpr int indices = 218;
+	constexpr int group = 219;
+	constexpr int draw_id = 220;
+}
+
+#endif // VISBUF_H